@@ -25,9 +25,12 @@ static struct Command const commands[] = {
 	{"<number> ^ <number> % <number>",
 		"Computes pow(a,b) mod n, where a, b, and n are the given hexadecimal numbers."},
 	{"isprime <number>", "Outputs 1 if the given hexadecimal integer is a prime number, otherwise 0."},
+	{"isprime (mr|bpsw) <number>",
+		"Like isprime, with the given test: mr is Miller-Rabin (the default), bpsw is Baillie-PSW, which has no known counterexamples."},
 	{"nextprime <number>", "Outputs the closest prime number greater than or equal to the given hexadecimal number."},
 	{"rand <decimal>", "Generates a random number with the requested length (in bytes). The decimal number must fit into an integer."},
-	{"randprime <decimal>", "Generates a random prime number with the requested length (in bytes). The decimal number must fit into an integer."}
+	{"randprime <decimal>", "Generates a random prime number with the requested length (in bytes). The decimal number must fit into an integer."},
+	{"safeprime <decimal>", "Generates a random safe prime p, with (p-1)/2 prime as well, with the requested length (in bits)."}
 };
 
 void help(char const * progname, FILE * file)
@@ -97,16 +100,40 @@ int main(
 				exit(EXIT_FAILURE);
 			}
 
-			VarInt rand;
-			vi_create_random_VarInt(&rand, len);
+			if(!len)
+			{
+				fputs("a prime needs at least one byte!", stderr);
+				exit(EXIT_FAILURE);
+			}
 
-			vi_next_prime_assign_VarInt(&rand, &rand);
+			VarInt rand;
+			vi_create_VarInt(&rand);
+			vi_random_prime_VarInt(&rand, 8 * len, 0);
 
 			char * str = vi_to_string_VarInt(&rand);
 			puts(str);
 
 			vi_free((void**)&str);
 			vi_destroy_VarInt(&rand);
+		} else if(!strcmp(argv[1], "safeprime"))
+		{
+			size_t bits;
+			if(1 != sscanf(argv[2], "%zu", &bits) || bits < 3)
+			{
+				fputs("second argument should be a decimal number of at least 3!", stderr);
+				help(*argv, stderr);
+				exit(EXIT_FAILURE);
+			}
+
+			VarInt p;
+			vi_create_VarInt(&p);
+			vi_random_prime_VarInt(&p, bits, kPrimeSafe);
+
+			char * str = vi_to_string_VarInt(&p);
+			puts(str);
+
+			vi_free((void**)&str);
+			vi_destroy_VarInt(&p);
 		}  else if(!strcmp(argv[1], "text"))
 		{
 			size_t len = strlen(argv[2]);
@@ -116,9 +143,13 @@ int main(
 			vi_calloc_digit(&x.digits,
 				x.capacity = cap);
 
-			for(size_t i = 1; i<=len; i++)
+			// the last character is the least significant byte.
+			for(size_t i = 0; i < len; i++)
 			{
-				((char*)x.digits)[len - i] = argv[2][i-1];
+				size_t const byte = len - 1 - i;
+				x.digits[byte / sizeof(digit_t)] |=
+					(digit_t)(unsigned char)argv[2][i]
+					<< (byte % sizeof(digit_t) * 8);
 			}
 
 			for(size_t i = cap; i--;)
@@ -162,6 +193,24 @@ int main(
 			fputs("invalid arguments.", stderr);
 			help(*argv, stderr);
 		}
+	} else if(argc == 4 && !strcmp(argv[1], "isprime"))
+	{
+		int bpsw = !strcmp(argv[2], "bpsw");
+		if(!bpsw && strcmp(argv[2], "mr"))
+		{
+			fputs("unknown primality test.", stderr);
+			help(*argv, stderr);
+			exit(EXIT_FAILURE);
+		}
+
+		VarInt p;
+		vi_create_from_hex_VarInt(
+			&p,
+			argv[3],
+			strlen(argv[3]));
+
+		puts((bpsw ? vi_is_prime_bpsw_VarInt(&p) : vi_is_prime_quick_VarInt(&p)) ? "1":"0");
+		vi_destroy_VarInt(&p);
 	} else if(argc == 4)
 	{
 		VarInt a;
@@ -1,6 +1,7 @@
 #include "heap.h"
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 uintptr_t vi_end_Entry(
 	Entry * this)
@@ -100,166 +101,157 @@ void vi_destroy_Entry(
 }
 
 
-void vi_create_Heap(
-	Heap * this,
-	size_t capacity)
+static size_t hole_class(
+	size_t size)
 {
-	assert(this != NULL);
+	assert(size != 0);
 
-	this->start = (uintptr_t) malloc(capacity);
-	assert(this->start != 0);
+	size_t k = 0;
+	while(size >>= 1)
+		++k;
+	return k;
+}
 
-	this->end = this->start + capacity;
-	this->first = this->last = 0;
-	this->blocks = 0;
+static void link_Hole(
+	Heap * heap,
+	Entry * before,
+	uintptr_t lo,
+	uintptr_t hi)
+{
+	if(hi <= lo || hi - lo < sizeof(Hole))
+		return;
+
+	Hole * const hole = (Hole *) lo;
+	Hole ** const bin = &heap->bins->bin[hole_class(hi - lo)];
+
+	hole->heap = heap;
+	hole->before = before;
+	hole->size = hi - lo;
+	hole->previous = NULL;
+	hole->next = *bin;
+	if(*bin)
+		(*bin)->previous = hole;
+	*bin = hole;
 }
 
-void vi_destroy_Heap(
-	Heap * this)
+static void unlink_Hole(
+	Hole * this)
 {
 	assert(this != NULL);
-	assert(this->blocks == 0 && "tried to destroy non-empty heap.");
 
-	for(Entry * it = this->first; it != NULL;)
+	if(this->previous)
+		this->previous->next = this->next;
+	else
 	{
-		Entry * next = it->next;
-
-		vi_destroy_Entry(it);
-
-		it = next;
+		Hole ** const bin = &this->heap->bins->bin[hole_class(this->size)];
+		assert(*bin == this);
+		*bin = this->next;
 	}
-
-	this->first = this->last = NULL;
-
-	if(this->start)
-		free((void*) this->start);
-	this->start = this->end = 0;
+	if(this->next)
+		this->next->previous = this->previous;
 }
 
+// the free space after entry, or at the start of the heap if entry is null.
+static void hole_bounds(
+	Heap const * heap,
+	Entry * entry,
+	uintptr_t * lo,
+	uintptr_t * hi)
+{
+	*lo = entry
+		? align_up(vi_end_Entry(entry), sizeof(Entry))
+		: align_up(heap->start, sizeof(Entry));
+	Entry const * const next = entry ? entry->next : heap->first;
+	*hi = next ? (uintptr_t) next : heap->end;
+}
 
-static Entry * last_possible_entry(
-	Heap const * this,
-	size_t size)
+Hole * vi_hole_after_Heap(
+	Heap * this,
+	Entry * entry)
 {
 	assert(this != NULL);
-	assert(size < this->end - this->start);
 
-	uintptr_t begin = align_down(this->end - size, sizeof(Entry));
-	return vi_entry_of_block(begin);
+	uintptr_t lo, hi;
+	hole_bounds(this, entry, &lo, &hi);
+	if(hi <= lo || hi - lo < sizeof(Hole))
+		return NULL;
+
+	Hole * const hole = (Hole *) lo;
+	assert(hole->heap == this);
+	assert(hole->before == entry);
+	assert(hole->size == hi - lo);
+	return hole;
 }
 
-void * vi_alloc_Heap(
-	Heap * const this,
+void * vi_alloc_Hole(
+	Hole * hole,
 	size_t size)
 {
-	assert(this != NULL);
-	assert(this->start != 0);
-	assert(this->end != 0);
+	assert(hole != NULL);
+	assert(size != 0);
+	assert(hole->size >= sizeof(Entry) + size);
 
-	// check for empty heap.
-	if(!this->blocks)
-	{
-		Entry * entry = (Entry*) align_up(this->start, sizeof(Entry));
-		uintptr_t begin = vi_begin_Entry(entry);
-		// Is there enough space in the empty heap for this entry?
-		if(begin + size < this->end)
-		{
-			this->first = this->last = entry;
-			vi_create_Entry(
-				entry,
-				this,
-				NULL,
-				NULL,
-				size);
-			++this->blocks;
-			return (void*) begin;
-		} else // The entire heap cannot hold the requested block, return null.
-		{
-			return NULL;
-		}
-	}
+	Heap * const heap = hole->heap;
+	Entry * const before = hole->before;
+	uintptr_t const hi = (uintptr_t) hole + hole->size;
+	unlink_Hole(hole);
 
-	// heap is not empty.
+	if(!heap->blocks)
+		vi_HeapListEntry_Heap(heap)->list->empty -= heap->end - heap->start;
 
-	Entry * left = (Entry*) align_up(this->start, sizeof(Entry));
+	Entry * const entry = (Entry *) hole;
+	Entry * const next = before ? before->next : heap->first;
+	vi_create_Entry(
+		entry,
+		heap,
+		before,
+		next,
+		size);
+	if(!before)
+		heap->first = entry;
+	if(!next)
+		heap->last = entry;
+	++heap->blocks;
+
+	link_Hole(heap, entry, align_up(vi_end_Entry(entry), sizeof(Entry)), hi);
+
+	return (void *) vi_begin_Entry(entry);
+}
 
-	// check before the first element.
-	if((left < this->first)
-	&& ((uintptr_t)this->first - vi_begin_Entry(left) > size))
-	{
-		vi_create_Entry(
-			left,
-			this,
-			NULL,
-			this->first,
-			size);
+void vi_create_Heap(
+	Heap * this,
+	HoleBins * bins,
+	size_t capacity)
+{
+	assert(this != NULL);
+	assert(bins != NULL);
 
-		this->first = left;
-		++this->blocks;
-		return (void*) vi_begin_Entry(left);
-	} else
-		left = this->first;
+	this->start = (uintptr_t) malloc(capacity);
+	assert(this->start != 0);
 
-	Entry * right = (Entry*) last_possible_entry(this, size);
+	this->end = this->start + capacity;
+	this->first = this->last = 0;
+	this->blocks = 0;
+	this->bins = bins;
 
-	// can it fit after the last entry?
-	if((uintptr_t)right >= vi_end_Entry(this->last))
-	{
-		vi_create_Entry(
-			right,
-			this,
-			this->last,
-			NULL,
-			size);
-		this->last = right;
+	link_Hole(this, NULL, align_up(this->start, sizeof(Entry)), this->end);
+}
 
-		++this->blocks;
-		return (void*)vi_begin_Entry(right);
-	} else
-	{
-		right = this->last;
-	}
+void vi_destroy_Heap(
+	Heap * this)
+{
+	assert(this != NULL);
+	assert(this->blocks == 0 && "tried to destroy non-empty heap.");
 
-	while(left <= right && (left || right))
-	{
-		// check before the right element.
-		if(right && right->previous)
-		{
-			if(vi_hole_Entry(right->previous) >= sizeof(Entry) + size)
-			{
-				Entry * insert = (Entry*) align_up(vi_end_Entry(right->previous), sizeof(Entry));
-				vi_create_Entry(
-					insert,
-					this,
-					right->previous,
-					right,
-					size);
-				++this->blocks;
-				return (void*) vi_begin_Entry(insert);
-			} else
-				right = right->previous;
-		}
+	Hole * const hole = vi_hole_after_Heap(this, NULL);
+	if(hole)
+		unlink_Hole(hole);
 
-		// check after the left element.
-		if(left && left->next)
-		{
-			if(vi_hole_Entry(left) >= sizeof(Entry) + size)
-			{
-				Entry * insert = (Entry*) align_up(vi_end_Entry(left), sizeof(Entry));
-				vi_create_Entry(
-					insert,
-					this,
-					left,
-					left->next,
-					size);
-				++this->blocks;
-				return (void*) vi_begin_Entry(insert);
-			} else
-				left = left->next;
-		}
-	}
+	this->first = this->last = NULL;
 
-	return NULL;
+	if(this->start)
+		free((void*) this->start);
+	this->start = this->end = 0;
 }
 
 HeapListEntry * vi_HeapListEntry_Heap(
@@ -284,14 +276,22 @@ void vi_create_HeapListEntry(
 	this->previous = prev;
 	this->next = next;
 
-	vi_create_Heap(&this->heap, capacity);
+	if(prev)
+		prev->next = this;
+	if(next)
+		next->previous = this;
+
+	vi_create_Heap(&this->heap, &list->bins, capacity);
+	list->empty += capacity;
 }
 
 void vi_destroy_HeapListEntry(
 	HeapListEntry * this)
 {
 	assert(this != NULL);
+	assert(!this->heap.blocks);
 
+	this->list->empty -= this->heap.end - this->heap.start;
 	if(this->list->first == this)
 		this->list->first = this->next;
 	if(this->list->last == this)
@@ -316,6 +316,9 @@ void vi_create_HeapList(
 	assert(this != 0);
 
 	this->first = this->last = NULL;
+	this->empty = 0;
+	for(size_t i = 0; i < kHoleBins; i++)
+		this->bins.bin[i] = NULL;
 }
 
 void vi_destroy_HeapList(
@@ -334,6 +337,25 @@ void vi_destroy_HeapList(
 	}
 }
 
+// a hole of at least need bytes, or null.
+static Hole * find_Hole(
+	HoleBins * bins,
+	size_t need)
+{
+	size_t const k = hole_class(need);
+
+	// every hole in a higher bin is large enough.
+	for(size_t i = k + 1; i < kHoleBins; i++)
+		if(bins->bin[i])
+			return bins->bin[i];
+
+	for(Hole * it = bins->bin[k]; it != NULL; it = it->next)
+		if(it->size >= need)
+			return it;
+
+	return NULL;
+}
+
 void * vi_alloc_HeapList(
 	HeapList * this,
 	size_t size)
@@ -342,32 +364,33 @@ void * vi_alloc_HeapList(
 	if(!size)
 		return NULL;
 
+	size_t const need = sizeof(Entry) + size;
 
-	for(HeapListEntry * it = this->first; it != NULL; it = it->next)
+	Hole * hole = find_Hole(&this->bins, need);
+	if(!hole)
 	{
-		void * ret = vi_alloc_Heap(&it->heap, size);
-		if(ret)
-			return ret;
-	}
+		// add some maneuvering room for when the malloc has a wrong alignment.
+		size_t capacity = need + sizeof(Entry) * 2;
+
+		HeapListEntry * entry = (HeapListEntry *) malloc(sizeof(HeapListEntry));
+		vi_create_HeapListEntry(
+			entry,
+			this,
+			this->last,
+			NULL,
+			(this->min_capacity > capacity)
+				? this->min_capacity
+				: capacity);
 
-	// add some maneuvering room for when the malloc has a wrong alignment.
-	size_t capacity = size + sizeof(Entry) * 2;
+		if(!this->first)
+			this->first = entry;
+		this->last = entry;
 
-	HeapListEntry * entry = (HeapListEntry *) malloc(sizeof(HeapListEntry));
-	vi_create_HeapListEntry(
-		entry,
-		this,
-		this->last,
-		NULL,
-		(this->min_capacity > capacity)
-			? this->min_capacity
-			: capacity);
-
-	if(!this->first)
-		this->first = entry;
-	this->last = entry;
-
-	return vi_alloc_Heap(&entry->heap, size);
+		hole = vi_hole_after_Heap(&entry->heap, NULL);
+		assert(hole != NULL && hole->size >= need);
+	}
+
+	return vi_alloc_Hole(hole, size);
 }
 
 void vi_free_block(
@@ -381,12 +404,93 @@ void vi_free_block(
 	if(entry->next)
 		assert(entry->next->previous == entry);
 	Heap * heap = entry->heap;
+	Entry * const before = entry->previous;
+
+	// merge the block with the holes on both sides.
+	Hole * hole;
+	if((hole = vi_hole_after_Heap(heap, before)))
+		unlink_Hole(hole);
+	if((hole = vi_hole_after_Heap(heap, entry)))
+		unlink_Hole(hole);
+
 	vi_destroy_Entry(entry);
 
+	uintptr_t lo, hi;
+	hole_bounds(heap, before, &lo, &hi);
+	link_Hole(heap, before, lo, hi);
+
+	// empty heaps stay in the list, with their memory binned as one hole.
 	if(!heap->blocks)
+		vi_HeapListEntry_Heap(heap)->list->empty += heap->end - heap->start;
+}
+
+void vi_trim_HeapList(
+	HeapList * this,
+	size_t keep)
+{
+	assert(this != NULL);
+
+	for(HeapListEntry * it = this->first; it != NULL && this->empty > keep;)
 	{
-		HeapListEntry * listentry = vi_HeapListEntry_Heap(heap);
-		vi_destroy_HeapListEntry(listentry);
-		free(listentry);
+		HeapListEntry * const next = it->next;
+
+		if(!it->heap.blocks)
+		{
+			vi_destroy_HeapListEntry(it);
+			free(it);
+		}
+
+		it = next;
 	}
-}
\ No newline at end of file
+}
+
+void * vi_grow_block(
+	void * block,
+	size_t size)
+{
+	assert(block != NULL);
+
+	Entry * const entry = vi_entry_of_block((uintptr_t)block);
+	if(entry->reserved >= size)
+		return block;
+
+	Heap * const heap = entry->heap;
+	Entry * const before = entry->previous, * const next = entry->next;
+	uintptr_t lo, hi;
+	hole_bounds(heap, before, &lo, &hi);
+	hi = next ? (uintptr_t) next : heap->end;
+
+	if(lo + sizeof(Entry) + size > hi)
+		return NULL;
+
+	Hole * hole;
+	if((hole = vi_hole_after_Heap(heap, entry)))
+		unlink_Hole(hole);
+
+	// grow forward if possible, otherwise move down into the space before.
+	Entry * grown = entry;
+	if(vi_begin_Entry(entry) + size > hi)
+	{
+		if((hole = vi_hole_after_Heap(heap, before)))
+			unlink_Hole(hole);
+
+		size_t const reserved = entry->reserved;
+		grown = (Entry *) lo;
+		memmove((void *) vi_begin_Entry(grown), block, reserved);
+		vi_create_Entry(
+			grown,
+			heap,
+			before,
+			next,
+			size);
+		if(heap->first == entry)
+			heap->first = grown;
+		if(heap->last == entry)
+			heap->last = grown;
+	} else
+		entry->reserved = size;
+
+	link_Hole(heap, grown, align_up(vi_end_Entry(grown), sizeof(Entry)), hi);
+
+	return (void *) vi_begin_Entry(grown);
+}
@@ -5,6 +5,8 @@
 #include <stddef.h>
 
 typedef struct Entry Entry;
+typedef struct Hole Hole;
+typedef struct HoleBins HoleBins;
 typedef struct Heap Heap;
 typedef struct HeapListEntry HeapListEntry;
 typedef struct HeapList HeapList;
@@ -38,6 +40,39 @@ void vi_create_Entry(
 void vi_destroy_Entry(
 	Entry * this);
 
+/* The free space between two entries, or between an entry and the end of
+its heap, is a hole. Holes of at least sizeof(Hole) bytes start with this
+header and are kept in the bins of their heap list, so a fitting hole is found
+without walking the entries. Smaller holes are only reclaimed when a
+neighbouring entry is freed. */
+struct Hole
+{
+	/** The heap this hole belongs to. */
+	Heap * heap;
+	/** The entry before this hole, or null if it is at the start of the heap. */
+	Entry * before;
+	/** The next hole in the same bin. */
+	Hole * next;
+	/** The previous hole in the same bin. */
+	Hole * previous;
+	/** The size of this hole, in bytes. */
+	size_t size;
+};
+
+enum { kHoleBins = sizeof(size_t) * 8 };
+
+struct HoleBins
+{
+	/** Bin k holds the holes of 2^k up to 2^(k+1)-1 bytes. */
+	Hole * bin[kHoleBins];
+};
+
+/** Unlinks hole from its bin and places a block of size bytes at its start.
+Returns the block. */
+void * vi_alloc_Hole(
+	Hole * hole,
+	size_t size);
+
 struct Heap
 {
 	/** The starting address. */
@@ -52,18 +87,24 @@ struct Heap
 
 	/** How many blocks this heap has. */
 	size_t blocks;
+
+	/** The bins this heap's holes are kept in. */
+	HoleBins * bins;
 };
 
 void vi_create_Heap(
 	Heap * this,
+	HoleBins * bins,
 	size_t capacity);
 
 void vi_destroy_Heap(
 	Heap * this);
 
-void * vi_alloc_Heap(
-	Heap * heap,
-	size_t size);
+/** The hole after entry, or at the start of the heap if entry is null.
+Returns null if it is too small to be kept in a bin. */
+Hole * vi_hole_after_Heap(
+	Heap * this,
+	Entry * entry);
 
 HeapListEntry * vi_HeapListEntry_Heap(
 	Heap * this);
@@ -101,6 +142,11 @@ struct HeapList
 
 	/** The minimal capacity a heap should have. */
 	size_t min_capacity;
+	/** The capacity of the heaps in this list that have no blocks, in bytes. */
+	size_t empty;
+
+	/** The holes of all heaps in this list. */
+	HoleBins bins;
 };
 
 void vi_create_HeapList(
@@ -112,7 +158,21 @@ void * vi_alloc_HeapList(
 	HeapList * this,
 	size_t capcity);
 
+/** Releases empty heaps until at most keep bytes of them are left. */
+void vi_trim_HeapList(
+	HeapList * this,
+	size_t keep);
+
+/** Frees block. A heap left without blocks is kept in its list, so that it can
+be reused without going through the system allocator; see vi_trim_HeapList. */
 void vi_free_block(
 	void * block);
 
+/** Grows block to size bytes into the free space after it, or, if that is
+too small, moves it down into the free space before it as well. Returns the
+grown block, or null and leaves the block unchanged if it does not fit. */
+void * vi_grow_block(
+	void * block,
+	size_t size);
+
 #endif
\ No newline at end of file
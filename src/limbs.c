@@ -0,0 +1,524 @@
+#include "limbs.h"
+#include <assert.h>
+#include <string.h>
+
+#if defined(USE_IA) && DIGIT_BITS == 64 && defined(__x86_64__) && defined(__GNUC__)
+#define LIMBS_IA
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+// operands with fewer digits than this are not worth converting for the IFMA basecase.
+#ifndef VI_IFMA_THRESHOLD
+#define VI_IFMA_THRESHOLD 16
+#endif
+#if VI_IFMA_THRESHOLD < 1
+#error "VI_IFMA_THRESHOLD must be at least 1."
+#endif
+
+// double width digit type, holds the full product of two digits.
+#if DIGIT_BITS == 64
+__extension__ typedef unsigned __int128 ddigit_t;
+#elif DIGIT_BITS == 32
+typedef uint64_t ddigit_t;
+#else
+typedef uint16_t ddigit_t;
+#endif
+
+typedef digit_t (*op_n_t)(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n);
+
+typedef digit_t (*op_1_t)(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m);
+
+typedef void (*mul_t)(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn);
+
+static digit_t add_n_c(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const sum = (ddigit_t) a[i] + b[i] + carry;
+		dest[i] = (digit_t) sum;
+		carry = (digit_t) (sum >> DIGIT_BITS);
+	}
+	return carry;
+}
+
+static digit_t sub_n_c(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	digit_t borrow = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const diff = (ddigit_t) a[i] - b[i] - borrow;
+		dest[i] = (digit_t) diff;
+		// a borrow wraps the double width difference around, setting the upper half.
+		borrow = (digit_t) (diff >> DIGIT_BITS) & 1;
+	}
+	return borrow;
+}
+
+static digit_t mul_1_c(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const product = (ddigit_t) a[i] * m + carry;
+		dest[i] = (digit_t) product;
+		carry = (digit_t) (product >> DIGIT_BITS);
+	}
+	return carry;
+}
+
+static digit_t addmul_1_c(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		// a * m + dest + carry fits into two digits.
+		ddigit_t const product = (ddigit_t) a[i] * m + dest[i] + carry;
+		dest[i] = (digit_t) product;
+		carry = (digit_t) (product >> DIGIT_BITS);
+	}
+	return carry;
+}
+
+#ifdef LIMBS_IA
+
+/* the additions run the carry through CF: the single digits first, then blocks
+of four. jrcxz and dec leave CF alone, so the count lives in rcx. */
+static digit_t add_n_x86(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	size_t rest = n % 4;
+	size_t const blocks = n / 4;
+	digit_t carry, t0, t1;
+	__asm__ volatile
+	(
+	"clc\n\t"
+	"jrcxz 2f\n"
+	"1:\n\t"
+	"movq (%[a]), %[t0]\n\t"
+	"adcq (%[b]), %[t0]\n\t"
+	"movq %[t0], (%[d])\n\t"
+	"leaq 8(%[a]), %[a]\n\t"
+	"leaq 8(%[b]), %[b]\n\t"
+	"leaq 8(%[d]), %[d]\n\t"
+	"decq %%rcx\n\t"
+	"jnz 1b\n"
+	"2:\n\t"
+	"movq %[blocks], %%rcx\n\t"
+	"jrcxz 4f\n"
+	"3:\n\t"
+	"movq (%[a]), %[t0]\n\t"
+	"movq 8(%[a]), %[t1]\n\t"
+	"adcq (%[b]), %[t0]\n\t"
+	"adcq 8(%[b]), %[t1]\n\t"
+	"movq %[t0], (%[d])\n\t"
+	"movq %[t1], 8(%[d])\n\t"
+	"movq 16(%[a]), %[t0]\n\t"
+	"movq 24(%[a]), %[t1]\n\t"
+	"adcq 16(%[b]), %[t0]\n\t"
+	"adcq 24(%[b]), %[t1]\n\t"
+	"movq %[t0], 16(%[d])\n\t"
+	"movq %[t1], 24(%[d])\n\t"
+	"leaq 32(%[a]), %[a]\n\t"
+	"leaq 32(%[b]), %[b]\n\t"
+	"leaq 32(%[d]), %[d]\n\t"
+	"decq %%rcx\n\t"
+	"jnz 3b\n"
+	"4:\n\t"
+	"movq $0, %[c]\n\t"
+	"adcq $0, %[c]"
+	: [d] "+r"(dest), [a] "+r"(a), [b] "+r"(b), "+c"(rest),
+	  [t0] "=&r"(t0), [t1] "=&r"(t1), [c] "=&r"(carry)
+	: [blocks] "r"(blocks)
+	: "cc", "memory");
+	return carry;
+}
+
+static digit_t sub_n_x86(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	size_t rest = n % 4;
+	size_t const blocks = n / 4;
+	digit_t borrow, t0, t1;
+	__asm__ volatile
+	(
+	"clc\n\t"
+	"jrcxz 2f\n"
+	"1:\n\t"
+	"movq (%[a]), %[t0]\n\t"
+	"sbbq (%[b]), %[t0]\n\t"
+	"movq %[t0], (%[d])\n\t"
+	"leaq 8(%[a]), %[a]\n\t"
+	"leaq 8(%[b]), %[b]\n\t"
+	"leaq 8(%[d]), %[d]\n\t"
+	"decq %%rcx\n\t"
+	"jnz 1b\n"
+	"2:\n\t"
+	"movq %[blocks], %%rcx\n\t"
+	"jrcxz 4f\n"
+	"3:\n\t"
+	"movq (%[a]), %[t0]\n\t"
+	"movq 8(%[a]), %[t1]\n\t"
+	"sbbq (%[b]), %[t0]\n\t"
+	"sbbq 8(%[b]), %[t1]\n\t"
+	"movq %[t0], (%[d])\n\t"
+	"movq %[t1], 8(%[d])\n\t"
+	"movq 16(%[a]), %[t0]\n\t"
+	"movq 24(%[a]), %[t1]\n\t"
+	"sbbq 16(%[b]), %[t0]\n\t"
+	"sbbq 24(%[b]), %[t1]\n\t"
+	"movq %[t0], 16(%[d])\n\t"
+	"movq %[t1], 24(%[d])\n\t"
+	"leaq 32(%[a]), %[a]\n\t"
+	"leaq 32(%[b]), %[b]\n\t"
+	"leaq 32(%[d]), %[d]\n\t"
+	"decq %%rcx\n\t"
+	"jnz 3b\n"
+	"4:\n\t"
+	"movq $0, %[c]\n\t"
+	"adcq $0, %[c]"
+	: [d] "+r"(dest), [a] "+r"(a), [b] "+r"(b), "+c"(rest),
+	  [t0] "=&r"(t0), [t1] "=&r"(t1), [c] "=&r"(borrow)
+	: [blocks] "r"(blocks)
+	: "cc", "memory");
+	return borrow;
+}
+
+/* mulx takes m from rdx and leaves the flags alone, so the high digit of one
+product is added to the low digit of the next through the CF chain of adcx. */
+static digit_t mul_1_adx(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry, low, high;
+	__asm__ volatile
+	(
+	"xorl %k[c], %k[c]\n"
+	"1:\n\t"
+	"mulxq (%[a]), %[low], %[high]\n\t"
+	"adcxq %[c], %[low]\n\t"
+	"movq %[low], (%[d])\n\t"
+	"movq %[high], %[c]\n\t"
+	"leaq 8(%[a]), %[a]\n\t"
+	"leaq 8(%[d]), %[d]\n\t"
+	"decq %[n]\n\t"
+	"jnz 1b\n\t"
+	"movl $0, %k[low]\n\t"
+	"adcxq %[low], %[c]"
+	: [d] "+r"(dest), [a] "+r"(a), [n] "+r"(n),
+	  [c] "=&r"(carry), [low] "=&r"(low), [high] "=&r"(high)
+	: "d"(m)
+	: "cc", "memory");
+	return carry;
+}
+
+/* as mul_1, with dest added in through the independent OF chain of adox.
+dec would clobber OF, so the loop counts down rcx with lea and jrcxz. */
+static digit_t addmul_1_adx(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry, low, high;
+	__asm__ volatile
+	(
+	"xorl %k[c], %k[c]\n"
+	"1:\n\t"
+	"mulxq (%[a]), %[low], %[high]\n\t"
+	"adcxq %[c], %[low]\n\t"
+	"adoxq (%[d]), %[low]\n\t"
+	"movq %[low], (%[d])\n\t"
+	"movq %[high], %[c]\n\t"
+	"leaq 8(%[a]), %[a]\n\t"
+	"leaq 8(%[d]), %[d]\n\t"
+	"leaq -1(%%rcx), %%rcx\n\t"
+	"jrcxz 2f\n\t"
+	"jmp 1b\n"
+	"2:\n\t"
+	"movl $0, %k[low]\n\t"
+	"adcxq %[low], %[c]\n\t"
+	"adoxq %[low], %[c]"
+	: [d] "+r"(dest), [a] "+r"(a), "+c"(n),
+	  [c] "=&r"(carry), [low] "=&r"(low), [high] "=&r"(high)
+	: "d"(m)
+	: "cc", "memory");
+	return carry;
+}
+
+/* the IFMA basecase keeps its operands in 52 bit limbs on the stack, so it
+takes a factor of at most kIfmaDigits digits. */
+enum { kIfmaDigits = 64, kIfmaLimbs = (64 * kIfmaDigits + 51) / 52 };
+#define LIMB_MASK (((uint64_t) 1 << 52) - 1)
+
+// limbs[0..count) = a[0..n) in 52 bit limbs, returns count.
+static size_t to_limbs(
+	uint64_t * limbs,
+	digit_t const * a,
+	size_t n)
+{
+	size_t const count = (64 * n + 51) / 52;
+	for(size_t k = 0; k < count; k++)
+	{
+		size_t const q = 52 * k / 64, s = 52 * k % 64;
+		uint64_t v = a[q] >> s;
+		if(s > 12 && q + 1 < n)
+			v |= a[q + 1] << (64 - s);
+		limbs[k] = v & LIMB_MASK;
+	}
+	return count;
+}
+
+/* dest[0..an+bn) = a * b by product scanning: eight neighbouring limbs of the
+product are summed up in one register each, the low and high halves of the
+52 bit products separately. Every limb product is below 2^104, and a column
+adds at most kIfmaLimbs of them, so the 64 bit lanes cannot overflow. */
+__attribute__((target("avx512f,avx512ifma")))
+static void mul_basecase_ifma_limbs(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	// a is padded with eight zero limbs on both sides, for the shifted loads.
+	uint64_t a_limbs[kIfmaLimbs + 16];
+	uint64_t b_limbs[kIfmaLimbs];
+	uint64_t low[2 * kIfmaLimbs + 8];
+	uint64_t high[2 * kIfmaLimbs + 8];
+	uint64_t r[2 * kIfmaLimbs + 2];
+
+	size_t const la = to_limbs(a_limbs + 8, a, an);
+	memset(a_limbs, 0, 8 * sizeof(uint64_t));
+	memset(a_limbs + 8 + la, 0, 8 * sizeof(uint64_t));
+	size_t const lb = to_limbs(b_limbs, b, bn);
+	size_t const lr = la + lb;
+
+	for(size_t t = 0; t < lr; t += 8)
+	{
+		__m512i sum_low = _mm512_setzero_si512();
+		__m512i sum_high = _mm512_setzero_si512();
+		// lane l adds a[t + l - j] * b[j], for the j where that index is valid in any lane.
+		size_t const first = t + 1 > la ? t + 1 - la : 0;
+		size_t const last = t + 7 < lb - 1 ? t + 7 : lb - 1;
+		for(size_t j = first; j <= last; j++)
+		{
+			__m512i const x = _mm512_loadu_si512(a_limbs + 8 + t - j);
+			__m512i const y = _mm512_set1_epi64((long long) b_limbs[j]);
+			sum_low = _mm512_madd52lo_epu64(sum_low, x, y);
+			sum_high = _mm512_madd52hi_epu64(sum_high, x, y);
+		}
+		_mm512_storeu_si512(low + t, sum_low);
+		_mm512_storeu_si512(high + t, sum_high);
+	}
+
+	// the high half of column t belongs to limb t + 1.
+	uint64_t carry = 0;
+	for(size_t t = 0; t < lr; t++)
+	{
+		uint64_t const v = low[t] + (t ? high[t - 1] : 0) + carry;
+		r[t] = v & LIMB_MASK;
+		carry = v >> 52;
+	}
+	r[lr] = r[lr + 1] = 0;
+
+	for(size_t i = 0; i < an + bn; i++)
+	{
+		size_t const q = 64 * i / 52, s = 64 * i % 52;
+		uint64_t v = (r[q] >> s) | (r[q + 1] << (52 - s));
+		if(s > 40)
+			v |= r[q + 2] << (104 - s);
+		dest[i] = v;
+	}
+}
+
+#endif
+
+// the schoolbook product row by row, with the selected kernels.
+static void mul_basecase_c(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn);
+
+#ifdef LIMBS_IA
+static void mul_basecase_ifma(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	if(an > kIfmaDigits || bn < VI_IFMA_THRESHOLD)
+		mul_basecase_c(dest, a, an, b, bn);
+	else
+		mul_basecase_ifma_limbs(dest, a, an, b, bn);
+}
+#endif
+
+static struct
+{
+	op_n_t add_n;
+	op_n_t sub_n;
+	op_1_t mul_1;
+	op_1_t addmul_1;
+	mul_t mul_basecase;
+	char const * name;
+} kernels = { add_n_c, sub_n_c, mul_1_c, addmul_1_c, mul_basecase_c, "c" };
+
+static void mul_basecase_c(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	dest[an] = kernels.mul_1(dest, a, an, b[0]);
+	for(size_t i = 1; i < bn; i++)
+		dest[an + i] = kernels.addmul_1(dest + i, a, an, b[i]);
+}
+
+#ifdef LIMBS_IA
+// picks the kernels for this CPU before main runs, so that no call races with it.
+__attribute__((constructor))
+static void select_kernels(void)
+{
+	kernels.add_n = add_n_x86;
+	kernels.sub_n = sub_n_x86;
+	kernels.name = "x86";
+
+	// mulx is BMI2, leaf 7 ebx bit 8. adcx and adox are ADX, bit 19.
+	unsigned a, b, c, d;
+	if(__get_cpuid_max(0, NULL) < 7)
+		return;
+	__cpuid_count(7, 0, a, b, c, d);
+	if((b >> 8 & 1) && (b >> 19 & 1))
+	{
+		kernels.mul_1 = mul_1_adx;
+		kernels.addmul_1 = addmul_1_adx;
+		kernels.name = "adx";
+	}
+
+	// AVX-512F is bit 16, IFMA bit 21. The OS must save the zmm state as well.
+	unsigned a1, b1, c1, d1;
+	__cpuid(1, a1, b1, c1, d1);
+	if(!(b >> 16 & 1) || !(b >> 21 & 1) || !(c1 >> 27 & 1))
+		return;
+	unsigned xcr0, xcr0_high;
+	__asm__ ("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+	if((xcr0 & 0xe6) == 0xe6)
+	{
+		kernels.mul_basecase = mul_basecase_ifma;
+		kernels.name = kernels.mul_1 == mul_1_adx ? "adx+ifma" : "x86+ifma";
+	}
+}
+#endif
+
+digit_t vi_add_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	assert(n);
+	return kernels.add_n(dest, a, b, n);
+}
+
+digit_t vi_sub_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	assert(n);
+	return kernels.sub_n(dest, a, b, n);
+}
+
+digit_t vi_mul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	assert(n);
+	return kernels.mul_1(dest, a, n, m);
+}
+
+digit_t vi_addmul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	assert(n);
+	return kernels.addmul_1(dest, a, n, m);
+}
+
+void vi_mul_basecase(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(an >= bn && bn);
+	kernels.mul_basecase(dest, a, an, b, bn);
+}
+
+void vi_mul_basecase_reference(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(an >= bn && bn);
+	// the C kernels, not the selected ones, so that an assembly bug shows up in comparisons.
+	dest[an] = mul_1_c(dest, a, an, b[0]);
+	for(size_t i = 1; i < bn; i++)
+		dest[an + i] = addmul_1_c(dest + i, a, an, b[i]);
+}
+
+char const * vi_limb_kernels(void)
+{
+	return kernels.name;
+}
@@ -0,0 +1,69 @@
+#ifndef __varint_limbs_h_defined
+#define __varint_limbs_h_defined
+
+#include "varint.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Kernels on digit vectors of n >= 1 digits. dest may be the same array as a
+source, but must not overlap one otherwise. With -DUSE_IA and 64 bit digits on
+x86-64, mulx/adcx/adox versions are selected at startup if the CPU has BMI2 and
+ADX, and adc/sbb versions of the additions are used on any x86-64 CPU. The
+schoolbook product uses AVX-512 IFMA where the CPU and OS support it. */
+
+/** dest[0..n) = a[0..n) + b[0..n), returns the carry. */
+digit_t vi_add_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n);
+
+/** dest[0..n) = a[0..n) - b[0..n), returns the borrow. */
+digit_t vi_sub_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n);
+
+/** dest[0..n) = a[0..n) * m, returns the carry digit. */
+digit_t vi_mul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m);
+
+/** dest[0..n) += a[0..n) * m, returns the carry digit. */
+digit_t vi_addmul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m);
+
+/** dest[0..an+bn) = a[0..an) * b[0..bn) by the schoolbook method, an >= bn >= 1.
+dest must not overlap the sources. */
+void vi_mul_basecase(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn);
+
+/** vi_mul_basecase with the scalar kernels only, to verify the vector kernel against. */
+void vi_mul_basecase_reference(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn);
+
+/** The name of the selected kernels: "c", "x86" or "adx", followed by "+ifma" if the basecase uses IFMA. */
+char const * vi_limb_kernels(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,72 +5,215 @@
 #include <string.h>
 #include <stdio.h>
 
-static HeapList heap_list;
+#ifdef CUSTOM_HEAP
+// every thread keeps up to this many bytes of empty heaps for reuse.
+#ifndef VI_HEAP_HIGH_WATERMARK
+#define VI_HEAP_HIGH_WATERMARK 1048576
+#endif
+// a thread with more empty heap bytes releases heaps down to this many.
+#ifndef VI_HEAP_LOW_WATERMARK
+#define VI_HEAP_LOW_WATERMARK 262144
+#endif
+#if VI_HEAP_LOW_WATERMARK > VI_HEAP_HIGH_WATERMARK
+#error "VI_HEAP_LOW_WATERMARK must not exceed VI_HEAP_HIGH_WATERMARK."
+#endif
+
+typedef struct ThreadHeap ThreadHeap;
+
+/* Every thread allocates from its own heap list, so allocations never wait on
+each other. A block freed by a thread other than its owner is pushed onto the
+owner's remote list, which the owner releases on its next allocation. A thread
+that ends hands its heap back as an orphan, which the next new thread adopts,
+and whose remote list vi_trim_heap drains until then. */
+struct ThreadHeap
+{
+	/** The heaps of this thread, must be the first member. */
+	HeapList list;
+	/** Blocks freed by other threads, linked through their first word. */
+	void * remote;
+	/** Whether no thread owns this heap, guarded by critical(heap). */
+	int orphaned;
+	/** The next thread heap. */
+	ThreadHeap * next;
+};
+
+// all thread heaps, guarded by critical(heap).
+static ThreadHeap * thread_heaps = NULL;
+static size_t default_capacity = 0;
+static size_t low_watermark = VI_HEAP_LOW_WATERMARK;
+static size_t high_watermark = VI_HEAP_HIGH_WATERMARK;
 static int heap_list_initialised = 0;
 
-void vi_set_default_heap_size(size_t capacity)
+static ThreadHeap * local_heap = NULL;
+#pragma omp threadprivate(local_heap)
+
+static ThreadHeap * owner_of_block(
+	void * block)
 {
-#ifdef CUSTOM_HEAP
-	#pragma omp critical(heap)
+	Heap * const heap = vi_entry_of_block((uintptr_t)block)->heap;
+	assert(heap != NULL);
+	return (ThreadHeap *) vi_HeapListEntry_Heap(heap)->list;
+}
+
+static void push_remote(
+	ThreadHeap * owner,
+	void * block)
+{
+#ifdef __GNUC__
+	void * head = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+	do
+		*(void **) block = head;
+	while(!__atomic_compare_exchange_n(
+		&owner->remote,
+		&head,
+		block,
+		1,
+		__ATOMIC_RELEASE,
+		__ATOMIC_RELAXED));
+#else
+	#pragma omp critical(heap_remote)
 	{
-		if(!heap_list_initialised)
-		{
-			vi_create_HeapList(&heap_list);
-			heap_list_initialised = 1;
-		}
+		*(void **) block = owner->remote;
+		owner->remote = block;
+	}
+#endif
+}
 
-		heap_list.min_capacity = capacity;
+// takes the whole remote list at once, so there is no ABA problem.
+static void * take_remote(
+	ThreadHeap * owner)
+{
+#ifdef __GNUC__
+	if(!__atomic_load_n(&owner->remote, __ATOMIC_RELAXED))
+		return NULL;
+	return __atomic_exchange_n(&owner->remote, NULL, __ATOMIC_ACQUIRE);
+#else
+	void * head;
+	#pragma omp critical(heap_remote)
+	{
+		head = owner->remote;
+		owner->remote = NULL;
 	}
+	return head;
 #endif
 }
 
-static void * _malloc(size_t typesize, size_t count)
+// frees a block of the calling thread's heap, keeping its empty heaps within the watermarks.
+static void local_free_block(
+	ThreadHeap * heap,
+	void * block)
 {
-	assert(typesize != 0);
-	assert(count != 0);
+	vi_free_block(block);
 
-	void * ptr = NULL;
-	ptr = vi_alloc_HeapList(&heap_list, typesize * count);
+	size_t high;
+	#pragma omp atomic read
+	high = high_watermark;
 
-	assert(ptr != NULL && "malloc failed");
-	assert(vi_entry_of_block((uintptr_t)ptr)->heap != NULL);
-	return ptr;
+	if(heap->list.empty > high)
+	{
+		size_t low;
+		#pragma omp atomic read
+		low = low_watermark;
+
+		vi_trim_HeapList(&heap->list, low);
+	}
 }
 
-void vi_malloc(void ** ptr, size_t typesize, size_t count)
+static void release_remote(
+	ThreadHeap * owner)
+{
+	for(void * block = take_remote(owner); block != NULL;)
+	{
+		void * const next = *(void **) block;
+		local_free_block(owner, block);
+		block = next;
+	}
+}
+
+// the calling thread's heap, created on its first allocation.
+static ThreadHeap * thread_heap()
 {
 	assert(heap_list_initialised);
 
-	assert(ptr != NULL);
-	assert(*ptr == NULL);
+	if(!local_heap)
+	{
+		ThreadHeap * heap = NULL;
+		#pragma omp critical(heap)
+		{
+			for(ThreadHeap * it = thread_heaps; it != NULL && !heap; it = it->next)
+				if(it->orphaned)
+				{
+					it->orphaned = 0;
+					heap = it;
+				}
+		}
 
-#ifdef CUSTOM_HEAP
-	#pragma omp critical (heap)
-	*ptr = _malloc(typesize, count);
-#else
-	*ptr = malloc(typesize * count);
-#endif
+		if(!heap)
+		{
+			heap = (ThreadHeap *) malloc(sizeof(ThreadHeap));
+			assert(heap != NULL && "malloc failed");
+			vi_create_HeapList(&heap->list);
+			heap->remote = NULL;
+			heap->orphaned = 0;
+
+			#pragma omp critical(heap)
+			{
+				heap->next = thread_heaps;
+				thread_heaps = heap;
+			}
+		}
+		local_heap = heap;
+	}
+
+	#pragma omp atomic read
+	local_heap->list.min_capacity = default_capacity;
+
+	release_remote(local_heap);
+	return local_heap;
 }
 
-void vi_calloc(void ** ptr, size_t typesize, size_t count)
+static void free_block(
+	void * block)
+{
+	ThreadHeap * const owner = owner_of_block(block);
+	if(owner == local_heap)
+		local_free_block(owner, block);
+	else
+		push_remote(owner, block);
+}
+
+static void * _malloc(ThreadHeap * heap, size_t typesize, size_t count)
 {
-	assert(ptr != NULL);
-	assert(*ptr == NULL);
 	assert(typesize != 0);
 	assert(count != 0);
 
-#ifdef CUSTOM_HEAP
-	vi_malloc(ptr, typesize, count);
-	memset(*ptr, 0, typesize * count);
-#else
-	*ptr = calloc(typesize, count);
-#endif
-}
+	// a block freed by another thread needs room for the remote list link.
+	size_t size = typesize * count;
+	if(size < sizeof(void *))
+		size = sizeof(void *);
 
+	void * ptr = NULL;
+	ptr = vi_alloc_HeapList(&heap->list, size);
 
-static void _realloc(void ** ptr, size_t typesize, size_t count)
+	assert(ptr != NULL && "malloc failed");
+	assert(vi_entry_of_block((uintptr_t)ptr)->heap != NULL);
+	return ptr;
+}
+
+static void _realloc(ThreadHeap * heap, void ** ptr, size_t typesize, size_t count)
 {
-	if(*ptr)
+	if(*ptr && owner_of_block(*ptr) != heap)
+	{
+		// the neighbours of another thread's block may change any time, so it cannot grow in place.
+		size_t const cap = vi_entry_of_block((uintptr_t)*ptr)->reserved;
+		if(cap >= typesize * count)
+			return;
+
+		void * reloc = _malloc(heap, typesize, count);
+		memcpy(reloc, *ptr, cap);
+		free_block(*ptr);
+		*ptr = reloc;
+	} else if(*ptr)
 	{
 		Entry * entry = vi_entry_of_block((uintptr_t)*ptr);
 
@@ -83,31 +226,120 @@ static void _realloc(void ** ptr, size_t typesize, size_t count)
 		if(cap >= typesize * count)
 			return;
 
-		size_t hole;
-		if(entry->next)
-		{
-			hole = (uintptr_t)entry->next - vi_end_Entry(entry);
-		} else
-		{
-			hole = entry->heap->end - vi_end_Entry(entry);
-		}
-
-		if(hole + cap >= count)
-		{
-			entry->reserved = count;
-		} else
+		// try the free space on either side of the block before copying it elsewhere.
+		void * grown = vi_grow_block(*ptr, typesize * count);
+		if(grown)
+			*ptr = grown;
+		else
 		{
 			void * reloc = NULL;
-			reloc = _malloc(typesize, count);
+			reloc = _malloc(heap, typesize, count);
 			memcpy(reloc, *ptr, cap);
-			vi_free_block(ptr);
+			local_free_block(heap, *ptr);
 			*ptr = reloc;
 		}
 	} else
 	{
-		*ptr = _malloc(typesize, count);
+		*ptr = _malloc(heap, typesize, count);
 	}
 }
+#endif
+
+void vi_set_default_heap_size(size_t capacity)
+{
+#ifdef CUSTOM_HEAP
+	#pragma omp atomic write
+	default_capacity = capacity;
+	#pragma omp critical(heap)
+	heap_list_initialised = 1;
+#endif
+}
+
+void vi_set_heap_watermarks(size_t low, size_t high)
+{
+	assert(low <= high);
+#ifdef CUSTOM_HEAP
+	#pragma omp atomic write
+	low_watermark = low;
+	#pragma omp atomic write
+	high_watermark = high;
+#endif
+}
+
+void vi_trim_heap(size_t keep)
+{
+#ifdef CUSTOM_HEAP
+	if(local_heap)
+	{
+		release_remote(local_heap);
+		vi_trim_HeapList(&local_heap->list, keep);
+	}
+
+	// no thread drains the orphans' remote lists, so the caller does.
+	#pragma omp critical(heap)
+	for(ThreadHeap ** link = &thread_heaps; *link != NULL;)
+	{
+		ThreadHeap * const heap = *link;
+		if(heap->orphaned)
+		{
+			release_remote(heap);
+			vi_trim_HeapList(&heap->list, 0);
+
+			// without heaps, no block can be pushed onto its remote list any more.
+			if(!heap->list.first)
+			{
+				*link = heap->next;
+				free(heap);
+				continue;
+			}
+		}
+		link = &heap->next;
+	}
+#endif
+}
+
+void vi_release_thread_heap(void)
+{
+#ifdef CUSTOM_HEAP
+	if(!local_heap)
+		return;
+
+	release_remote(local_heap);
+	vi_trim_HeapList(&local_heap->list, 0);
+
+	#pragma omp critical(heap)
+	local_heap->orphaned = 1;
+	local_heap = NULL;
+#endif
+}
+
+void vi_malloc(void ** ptr, size_t typesize, size_t count)
+{
+	assert(ptr != NULL);
+	assert(*ptr == NULL);
+
+#ifdef CUSTOM_HEAP
+	*ptr = _malloc(thread_heap(), typesize, count);
+#else
+	*ptr = malloc(typesize * count);
+#endif
+}
+
+void vi_calloc(void ** ptr, size_t typesize, size_t count)
+{
+	assert(ptr != NULL);
+	assert(*ptr == NULL);
+	assert(typesize != 0);
+	assert(count != 0);
+
+#ifdef CUSTOM_HEAP
+	vi_malloc(ptr, typesize, count);
+	memset(*ptr, 0, typesize * count);
+#else
+	*ptr = calloc(typesize, count);
+#endif
+}
+
 
 void vi_realloc(void ** ptr, size_t typesize, size_t count)
 {
@@ -115,8 +347,7 @@ void vi_realloc(void ** ptr, size_t typesize, size_t count)
 	assert(typesize != 0);
 	assert(count != 0);
 #ifdef CUSTOM_HEAP
-	#pragma omp critical (heap)
-	_realloc(ptr, typesize, count);
+	_realloc(thread_heap(), ptr, typesize, count);
 #else
 	*ptr = realloc(*ptr, typesize * count);
 #endif
@@ -126,8 +357,7 @@ void vi_free(void ** ptr)
 	assert(ptr != NULL);
 	assert(*ptr != NULL);
 #ifdef CUSTOM_HEAP
-	#pragma omp critical(heap)
-	vi_free_block(*ptr);
+	free_block(*ptr);
 #else
 	free(*ptr);
 #endif
@@ -151,7 +381,12 @@ void vi_destroy_heap()
 	#pragma omp critical(heap)
 	if(heap_list_initialised)
 	{
-		vi_destroy_HeapList(&heap_list);
+		// the thread heaps stay registered, only their memory is released.
+		for(ThreadHeap * it = thread_heaps; it != NULL; it = it->next)
+		{
+			release_remote(it);
+			vi_destroy_HeapList(&it->list);
+		}
 		heap_list_initialised = 0;
 	}
 #endif
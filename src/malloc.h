@@ -10,6 +10,17 @@ extern "C" {
 #endif
 
 void vi_set_default_heap_size(size_t capacity);
+/** With CUSTOM_HEAP, every thread keeps the heaps its frees leave empty, so
+they can be reused without the system allocator. Once their capacity exceeds
+high bytes, it releases them down to low bytes. */
+void vi_set_heap_watermarks(size_t low, size_t high);
+/** Releases the calling thread's empty heaps until at most keep bytes of them
+are left, and the blocks freed into the heaps of ended threads. */
+void vi_trim_heap(size_t keep);
+/** With CUSTOM_HEAP, hands the calling thread's heap over to the next thread
+that allocates, and releases its empty heaps. Threads about to end, such as
+OpenMP workers before their pool is torn down, should call it. */
+void vi_release_thread_heap(void);
 
 
 void vi_malloc(void ** ptr, size_t typesize, size_t count);
@@ -0,0 +1,334 @@
+#include "ntt.h"
+#include "malloc.h"
+#include <assert.h>
+#include <stdint.h>
+
+/* The operands are cut into 32 bit coefficients, transformed modulo three
+primes below 2^30, multiplied pointwise and recombined with the chinese
+remainder theorem. A coefficient of the product is less than
+2^22 * 2^64 < p0 * p1 * p2 for transforms up to 2^23 points. */
+
+#define NTT_PRIMES 3
+#define NTT_MAX_LOG 23
+#define CHUNK_BITS 32
+
+typedef struct
+{
+	/** The prime modulus. */
+	uint32_t p;
+	/** -p^-1 mod 2^32, for Montgomery reduction. */
+	uint32_t p_neg_inv;
+	/** 2^64 mod p, converts into the Montgomery form. */
+	uint32_t r2;
+	/** A generator of the multiplicative group. */
+	uint32_t g;
+} Prime;
+
+static Prime primes[NTT_PRIMES] = {
+	{ 998244353u, 0, 0, 3 },
+	{ 167772161u, 0, 0, 3 },
+	{ 469762049u, 0, 0, 3 }
+};
+
+static uint32_t pow_mod(
+	uint32_t base,
+	uint64_t exp,
+	uint32_t p)
+{
+	uint64_t result = 1, b = base % p;
+	for(; exp; exp >>= 1)
+	{
+		if(exp & 1)
+			result = result * b % p;
+		b = b * b % p;
+	}
+	return (uint32_t) result;
+}
+
+static void init_primes(void)
+{
+	static int initialised = 0;
+#ifdef __GNUC__
+	// the release store below publishes the constants to this acquire load.
+	if(__atomic_load_n(&initialised, __ATOMIC_ACQUIRE))
+		return;
+#endif
+
+	#pragma omp critical(ntt_init)
+	if(!initialised)
+	{
+		for(int i = 0; i < NTT_PRIMES; i++)
+		{
+			Prime * const prime = &primes[i];
+			// Newton iteration for p^-1 mod 2^32.
+			uint32_t inv = prime->p;
+			for(int j = 0; j < 4; j++)
+				inv *= 2 - prime->p * inv;
+			prime->p_neg_inv = 0u - inv;
+
+			uint64_t const r = ((uint64_t) 1 << 32) % prime->p;
+			prime->r2 = (uint32_t) (r * r % prime->p);
+		}
+#ifdef __GNUC__
+		__atomic_store_n(&initialised, 1, __ATOMIC_RELEASE);
+#else
+		initialised = 1;
+#endif
+	}
+}
+
+// Montgomery reduction, returns t * 2^-32 mod p for t < p * 2^32.
+static inline uint32_t redc(
+	uint64_t t,
+	Prime const * prime)
+{
+	uint32_t const m = (uint32_t) t * prime->p_neg_inv;
+	uint32_t r = (uint32_t) ((t + (uint64_t) m * prime->p) >> 32);
+	return r >= prime->p ? r - prime->p : r;
+}
+
+static inline uint32_t mont_mul(
+	uint32_t a,
+	uint32_t b,
+	Prime const * prime)
+{
+	return redc((uint64_t) a * b, prime);
+}
+
+static inline uint32_t mont_from(
+	uint32_t a,
+	Prime const * prime)
+{
+	return mont_mul(a, prime->r2, prime);
+}
+
+// fills roots[0..n/2) with the powers of a primitive n-th root of unity, in Montgomery form.
+static void make_roots(
+	uint32_t * roots,
+	size_t n,
+	int inverse,
+	Prime const * prime)
+{
+	uint32_t w = pow_mod(prime->g, (prime->p - 1) / n, prime->p);
+	if(inverse)
+		w = pow_mod(w, prime->p - 2, prime->p);
+
+	uint32_t const w_mont = mont_from(w, prime);
+	uint32_t cur = mont_from(1, prime);
+	for(size_t j = 0; j < n / 2; j++)
+	{
+		roots[j] = cur;
+		cur = mont_mul(cur, w_mont, prime);
+	}
+}
+
+// decimation in frequency, natural order in, bit reversed order out.
+static void ntt_forward(
+	uint32_t * a,
+	size_t n,
+	uint32_t const * roots,
+	Prime const * prime)
+{
+	uint32_t const p = prime->p;
+	for(size_t len = n / 2, stride = 1; len; len >>= 1, stride <<= 1)
+		for(size_t i = 0; i < n; i += 2 * len)
+			for(size_t j = 0; j < len; j++)
+			{
+				uint32_t const u = a[i + j];
+				uint32_t const v = a[i + j + len];
+				uint32_t const sum = u + v;
+				a[i + j] = sum >= p ? sum - p : sum;
+				a[i + j + len] = mont_mul(u + p - v, roots[j * stride], prime);
+			}
+}
+
+// decimation in time, bit reversed order in, natural order out.
+static void ntt_inverse(
+	uint32_t * a,
+	size_t n,
+	uint32_t const * roots,
+	Prime const * prime)
+{
+	uint32_t const p = prime->p;
+	for(size_t len = 1, stride = n / 2; len < n; len <<= 1, stride >>= 1)
+		for(size_t i = 0; i < n; i += 2 * len)
+			for(size_t j = 0; j < len; j++)
+			{
+				uint32_t const u = a[i + j];
+				uint32_t const v = mont_mul(a[i + j + len], roots[j * stride], prime);
+				uint32_t const sum = u + v;
+				a[i + j] = sum >= p ? sum - p : sum;
+				a[i + j + len] = u >= v ? u - v : u + p - v;
+			}
+}
+
+static size_t chunk_count(
+	size_t digits)
+{
+	return (digits * DIGIT_BITS + CHUNK_BITS - 1) / CHUNK_BITS;
+}
+
+static uint32_t get_chunk(
+	digit_t const * a,
+	size_t n,
+	size_t i)
+{
+#if DIGIT_BITS == 64
+	(void) n;
+	return (uint32_t) (a[i / 2] >> (i % 2 * 32));
+#elif DIGIT_BITS == 32
+	(void) n;
+	return a[i];
+#else
+	uint32_t chunk = 0;
+	for(size_t j = 0; j < 4 && 4 * i + j < n; j++)
+		chunk |= (uint32_t) a[4 * i + j] << (8 * j);
+	return chunk;
+#endif
+}
+
+static void set_chunk(
+	digit_t * a,
+	size_t n,
+	size_t i,
+	uint32_t chunk)
+{
+#if DIGIT_BITS == 64
+	(void) n;
+	if(i % 2)
+		a[i / 2] |= (digit_t) chunk << 32;
+	else
+		a[i / 2] = chunk;
+#elif DIGIT_BITS == 32
+	(void) n;
+	a[i] = chunk;
+#else
+	for(size_t j = 0; j < 4 && 4 * i + j < n; j++)
+		a[4 * i + j] = (digit_t) (chunk >> (8 * j));
+#endif
+}
+
+size_t vi_ntt_max_digits(void)
+{
+	return ((size_t) 1 << NTT_MAX_LOG) * CHUNK_BITS / DIGIT_BITS;
+}
+
+/* transforms a and b modulo the given prime and stores their product's residues in fa.
+Squares only need a single forward transform. */
+static void convolve(
+	uint32_t * fa,
+	uint32_t * fb,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn,
+	size_t n,
+	uint32_t * roots,
+	Prime const * prime)
+{
+	int const square = a == b && an == bn;
+	size_t const ac = chunk_count(an), bc = chunk_count(bn);
+
+	for(size_t i = 0; i < n; i++)
+		fa[i] = i < ac ? get_chunk(a, an, i) % prime->p : 0;
+
+	make_roots(roots, n, 0, prime);
+	ntt_forward(fa, n, roots, prime);
+
+	if(!square)
+	{
+		for(size_t i = 0; i < n; i++)
+			fb[i] = i < bc ? get_chunk(b, bn, i) % prime->p : 0;
+		ntt_forward(fb, n, roots, prime);
+	}
+
+	// the pointwise product picks up a factor of 2^-32, which the scaling removes again.
+	uint32_t const * const fs = square ? fa : fb;
+	for(size_t i = 0; i < n; i++)
+		fa[i] = mont_mul(fa[i], fs[i], prime);
+
+	make_roots(roots, n, 1, prime);
+	ntt_inverse(fa, n, roots, prime);
+
+	uint32_t const scale = mont_from(
+		mont_from(pow_mod((uint32_t) n, prime->p - 2, prime->p), prime),
+		prime);
+	for(size_t i = 0; i < n; i++)
+		fa[i] = mont_mul(fa[i], scale, prime);
+}
+
+// acc[word..3) += v.
+static void acc_add(
+	uint32_t * acc,
+	int word,
+	uint64_t v)
+{
+	for(; word < 3 && v; word++)
+	{
+		v += acc[word];
+		acc[word] = (uint32_t) v;
+		v >>= 32;
+	}
+	assert(!v);
+}
+
+void vi_mul_ntt(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(dest != NULL);
+	assert(a != NULL && an);
+	assert(b != NULL && bn);
+	assert(an + bn <= vi_ntt_max_digits());
+
+	init_primes();
+
+	size_t const out_chunks = chunk_count(an + bn);
+	size_t n = 2;
+	while(n < out_chunks)
+		n <<= 1;
+
+	uint32_t * buffer = NULL;
+	vi_malloc(
+		(void**)&buffer,
+		sizeof(uint32_t),
+		(NTT_PRIMES + 1) * n + n / 2);
+	uint32_t * const fb = buffer + NTT_PRIMES * n;
+	uint32_t * const roots = fb + n;
+
+	for(int i = 0; i < NTT_PRIMES; i++)
+		convolve(buffer + i * n, fb, a, an, b, bn, n, roots, &primes[i]);
+
+	// Garner's algorithm: x = r0 + p0 * (t1 + p1 * t2).
+	uint32_t const p0 = primes[0].p, p1 = primes[1].p, p2 = primes[2].p;
+	uint64_t const p0p1 = (uint64_t) p0 * p1;
+	uint64_t const inv_p0 = pow_mod(p0 % p1, p1 - 2, p1);
+	uint64_t const inv_p0p1 = pow_mod((uint32_t) (p0p1 % p2), p2 - 2, p2);
+
+	uint32_t acc[3] = { 0, 0, 0 };
+	for(size_t i = 0; i < out_chunks; i++)
+	{
+		uint64_t const r0 = buffer[i];
+		uint64_t const r1 = buffer[n + i];
+		uint64_t const r2 = buffer[2 * n + i];
+
+		uint64_t const t1 = (r1 + p1 - r0 % p1) * inv_p0 % p1;
+		uint64_t const x01 = r0 + p0 * t1;
+		uint64_t const t2 = (r2 + p2 - x01 % p2) * inv_p0p1 % p2;
+
+		acc_add(acc, 0, x01);
+		acc_add(acc, 0, (p0p1 & 0xffffffffu) * t2);
+		acc_add(acc, 1, (p0p1 >> 32) * t2);
+
+		set_chunk(dest, an + bn, i, acc[0]);
+		acc[0] = acc[1];
+		acc[1] = acc[2];
+		acc[2] = 0;
+	}
+	assert(!acc[0] && !acc[1]);
+
+	vi_free((void**)&buffer);
+}
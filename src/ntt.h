@@ -0,0 +1,27 @@
+#ifndef __varint_ntt_h_defined
+#define __varint_ntt_h_defined
+
+#include "varint.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** The maximal number of digits a product computed by vi_mul_ntt may have. */
+size_t vi_ntt_max_digits(void);
+
+/** Multiplies two digit arrays using a three-prime number theoretic transform.
+	dest[0..an+bn) = a[0..an) * b[0..bn). an + bn must not exceed vi_ntt_max_digits(), and dest must not overlap the sources. */
+void vi_mul_ntt(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
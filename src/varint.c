@@ -1,9 +1,23 @@
 #include "varint.h"
 #include "malloc.h"
+#include "ntt.h"
+#include "limbs.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <stdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// double width digit type, holds the full product of two digits.
+#if DIGIT_BITS == 64
+__extension__ typedef unsigned __int128 ddigit_t;
+#elif DIGIT_BITS == 32
+typedef uint64_t ddigit_t;
+#else
+typedef uint16_t ddigit_t;
+#endif
 
 static digit_t const
 	digit_one = 1,
@@ -58,9 +72,20 @@ void vi_create_from_int_VarInt(
 		this->capacity = (sizeof(int) / sizeof(digit_t))
 			+ !!(sizeof(int) % sizeof(digit_t)));
 
-	for(size_t d = 0; d < sizeof(int) / sizeof(digit_t); d++)
+	// store the magnitude, the sign is kept separately.
+	unsigned magnitude = value >= 0
+		? (unsigned) value
+		: 0u - (unsigned) value;
+
+	for(size_t d = 0; magnitude; d++)
 	{
-		this->digits[d] = (digit_t)(value >> (d * DIGIT_BITS));
+		this->digits[d] = (digit_t) magnitude;
+		this->size = d + 1;
+#if DIGIT_BITS < 32
+		magnitude >>= DIGIT_BITS;
+#else
+		magnitude = 0;
+#endif
 	}
 
 	this->sign = value >= 0 ? kPos : kNeg;
@@ -121,6 +146,41 @@ void vi_create_random_VarInt(
 	vi_assign_random_VarInt(this, length);
 }
 
+/* /dev/urandom is opened on first use and kept open for the lifetime of the
+process, stdio locks the stream for concurrent reads. */
+static FILE * random_source(void)
+{
+	static FILE * source = NULL;
+	FILE * file;
+
+#ifdef __GNUC__
+	if((file = __atomic_load_n(&source, __ATOMIC_ACQUIRE)))
+		return file;
+#endif
+
+	#pragma omp critical(random_source)
+	{
+		if(!source)
+		{
+			file = fopen("/dev/urandom", "r");
+#ifdef __GNUC__
+			__atomic_store_n(&source, file, __ATOMIC_RELEASE);
+#else
+			source = file;
+#endif
+		}
+		file = source;
+	}
+
+	if(!file)
+	{
+		fputs("could not open /dev/urandom", stderr);
+		exit(EXIT_FAILURE);
+	}
+
+	return file;
+}
+
 void vi_assign_random_VarInt(
 	VarInt * this,
 	size_t length)
@@ -144,27 +204,16 @@ void vi_assign_random_VarInt(
 			&this->digits,
 			this->capacity = min_cap);
 	}
-	else
-	{
-		for(size_t i = min_cap - 1; i < this->capacity; i++)
-			this->digits[i] = 0;
-	}
 
-	FILE * random = fopen("/dev/urandom", "r");
-	if(!random)
-	{
-		fputs("could not open /dev/urandom", stderr);
-		exit(EXIT_FAILURE);
-	}
+	// the last digit might only be partially filled.
+	this->digits[min_cap - 1] = 0;
 
-	if(length > fread(this->digits, 1, length, random))
+	if(length > fread(this->digits, 1, length, random_source()))
 	{
 		fputs("error reading from /dev/urandom", stderr);
 		exit(EXIT_FAILURE);
 	}
 
-	fclose(random);
-
 	for(size_t i = min_cap; i--;)
 		if(this->digits[i])
 		{
@@ -212,6 +261,159 @@ void vi_copy_digit(
 		count);
 }
 
+/* Every thread has a stack of scratch digits for the temporaries of its
+operations. An operation takes a mark, pushes the digit buffers it needs, and
+pops back to the mark when it ends, so once the stack has grown to the size
+of the largest operation no temporary goes through the allocator. The stack
+is made of chunks that never move, so pushed buffers stay valid until popped.
+Chunks popped off are kept for the next push unless they exceed
+VI_SCRATCH_LIMIT digits. The chunks are plain malloc memory, which
+vi_trim_scratch releases. */
+typedef struct ScratchChunk ScratchChunk;
+struct ScratchChunk
+{
+	ScratchChunk * previous;
+	ScratchChunk * next;
+	size_t capacity;
+	size_t used;
+	digit_t digits[];
+};
+
+typedef struct
+{
+	ScratchChunk * chunk;
+	size_t used;
+} ScratchMark;
+
+// the first chunk's size in digits, the later ones at least double.
+enum { kScratchChunk = 1024 };
+// popped chunks of more than this many digits are freed instead of kept.
+#ifndef VI_SCRATCH_LIMIT
+#define VI_SCRATCH_LIMIT (4194304 / DIGIT_BITS)
+#endif
+#if VI_SCRATCH_LIMIT < 0
+#error "VI_SCRATCH_LIMIT must not be negative."
+#endif
+
+static ScratchChunk * scratch_chunk = NULL;
+#pragma omp threadprivate(scratch_chunk)
+
+static ScratchChunk * scratch_new_chunk(
+	ScratchChunk * previous,
+	size_t capacity)
+{
+	ScratchChunk * const chunk = malloc(sizeof(ScratchChunk) + capacity * sizeof(digit_t));
+	assert(chunk != NULL && "malloc failed");
+	chunk->previous = previous;
+	chunk->next = NULL;
+	chunk->capacity = capacity;
+	chunk->used = 0;
+	return chunk;
+}
+
+static ScratchMark scratch_mark(void)
+{
+	if(!scratch_chunk)
+		scratch_chunk = scratch_new_chunk(NULL, kScratchChunk);
+
+	ScratchMark const mark = { scratch_chunk, scratch_chunk->used };
+	return mark;
+}
+
+// count digits from the stack, valid until the stack is popped below them.
+static digit_t * scratch_push(
+	size_t count)
+{
+	assert(scratch_chunk != NULL && "take a mark first");
+
+	ScratchChunk * chunk = scratch_chunk;
+	if(chunk->capacity - chunk->used < count)
+	{
+		// the chunks after the current one are unused.
+		ScratchChunk * next = chunk->next;
+		if(!next || next->capacity < count)
+		{
+			while(next)
+			{
+				ScratchChunk * const after = next->next;
+				free(next);
+				next = after;
+			}
+
+			next = scratch_new_chunk(
+				chunk,
+				count > 2 * chunk->capacity ? count : 2 * chunk->capacity);
+			chunk->next = next;
+		}
+		chunk = scratch_chunk = next;
+	}
+
+	digit_t * const digits = chunk->digits + chunk->used;
+	chunk->used += count;
+	return digits;
+}
+
+// releases everything pushed since mark.
+static void scratch_pop(
+	ScratchMark mark)
+{
+	for(ScratchChunk * chunk = scratch_chunk; chunk != mark.chunk; chunk = chunk->previous)
+	{
+		assert(chunk != NULL);
+		chunk->used = 0;
+	}
+
+	assert(mark.used <= mark.chunk->used);
+	mark.chunk->used = mark.used;
+	scratch_chunk = mark.chunk;
+
+	// the chunks grow, so all of them from the first one too large on are freed.
+	ScratchChunk ** link = &mark.chunk->next;
+	while(*link && (*link)->capacity <= (size_t) VI_SCRATCH_LIMIT)
+		link = &(*link)->next;
+	for(ScratchChunk * chunk = *link; chunk;)
+	{
+		ScratchChunk * const next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	*link = NULL;
+}
+
+void vi_trim_scratch(void)
+{
+	if(!scratch_chunk)
+		return;
+
+	ScratchChunk * chunk = scratch_chunk;
+	while(chunk->previous)
+		chunk = chunk->previous;
+
+	while(chunk)
+	{
+		assert(!chunk->used && "scratch digits are still in use");
+		ScratchChunk * const next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	scratch_chunk = NULL;
+}
+
+// a read-only copy of src on the scratch stack, for when an output is also a source.
+static VarInt scratch_copy_VarInt(
+	VarInt const * src)
+{
+	VarInt copy = {
+		src->size ? scratch_push(src->size) : NULL,
+		src->size,
+		0,
+		src->sign
+	};
+	if(src->size)
+		memcpy(copy.digits, src->digits, src->size * sizeof(digit_t));
+	return copy;
+}
+
 
 void digit_add(
 	digit_t a,
@@ -224,31 +426,9 @@ void digit_add(
 	assert(carry != NULL);
 	assert(c_in == 0 || c_in == 1);
 
-#ifdef USE_IA
-	digit_t _carry;
-	digit_t _result;
-	// first addition
-	__asm__ volatile
-	(
-	"add %3, %0;"
-	"adc $0, %1;"
-	: "=a"(_result), "=c"(_carry)
-	: "a"(a), "r"(b), "c"(0));
-
-	digit_t carry2;
-	__asm__ volatile
-	(
-	"add %3, %0;"
-	"adc $0, %1;"
-	: "=a"(_result), "=c"(carry2)
-	: "a"(_result), "b"(c_in), "c"(0));
-
-	*out = _result;
-	*carry = (_carry || carry2);
-#else
-	*carry = (b > DIGIT_MAX - a || a+b > DIGIT_MAX - c_in) ? 1 : 0;
-	*out = a + b + c_in;
-#endif
+	ddigit_t const sum = (ddigit_t) a + b + c_in;
+	*out = (digit_t) sum;
+	*carry = (digit_t) (sum >> DIGIT_BITS);
 }
 
 void digit_sub(
@@ -262,31 +442,10 @@ void digit_sub(
 	assert(carry != NULL);
 	assert(c_in == 0 || c_in == 1);
 
-#ifdef USE_IA
-	digit_t _carry;
-	digit_t _result;
-	// first addition
-	__asm__ volatile
-	(
-	"sub %3, %0;"
-	"adc $0, %1;"
-	: "=a"(_result), "=c"(_carry)
-	: "a"(a), "r"(b), "c"(0));
-
-	digit_t carry2;
-	__asm__ volatile
-	(
-	"sub %3, %0;"
-	"adc $0, %1;"
-	: "=a"(_result), "=c"(carry2)
-	: "a"(_result), "b"(c_in), "c"(0));
-
-	*out = _result;
-	*carry = (_carry || carry2);
-#else
-	*carry = (a < b || b > DIGIT_MAX - c_in || a < b + c_in) ? 1 : 0;
-	*out = a - (b+c_in);
-#endif
+	ddigit_t const diff = (ddigit_t) a - b - c_in;
+	*out = (digit_t) diff;
+	// a borrow wraps the double width difference around, setting the upper half.
+	*carry = (digit_t) (diff >> DIGIT_BITS) & 1;
 }
 
 static void internal_add_assign_VarInt(
@@ -300,19 +459,19 @@ static void internal_add_assign_VarInt(
 
 	if(dest == srca)
 	{
-		VarInt copy_srca;
-		vi_copy_create_VarInt(&copy_srca, srca);
+		ScratchMark const mark = scratch_mark();
+		VarInt const copy_srca = scratch_copy_VarInt(srca);
 		internal_add_assign_VarInt(dest, &copy_srca, srcb);
-		vi_destroy_VarInt(&copy_srca);
+		scratch_pop(mark);
 		return;
 	}
 
 	if(dest == srcb)
 	{
-		VarInt copy_srcb;
-		vi_copy_create_VarInt(&copy_srcb, srcb);
+		ScratchMark const mark = scratch_mark();
+		VarInt const copy_srcb = scratch_copy_VarInt(srcb);
 		internal_add_assign_VarInt(dest, srca, &copy_srcb);
-		vi_destroy_VarInt(&copy_srcb);
+		scratch_pop(mark);
 		return;
 	}
 
@@ -353,16 +512,7 @@ static void internal_add_assign_VarInt(
 
 	dest->size = 0;
 
-	carry = 0;
-	for(size_t i = 0; i < shorter->size; i++)
-	{
-		digit_add(
-			longer->digits[i],
-			shorter->digits[i],
-			carry,
-			&dest->digits[i],
-			&carry);
-	}
+	carry = vi_add_n(dest->digits, longer->digits, shorter->digits, shorter->size);
 	for(size_t i = shorter->size; i < longer->size; i++)
 	{
 		digit_add(
@@ -392,364 +542,1632 @@ static void digit_mul(
 	assert(low != NULL);
 	assert(high != NULL);
 
-#ifdef USE_IA
-	// first addition
-	#if DIGIT_MAX != UCHAR_MAX
-		__asm__ volatile
-		(
-		"mul %3"
-		: "=a"(*low), "=d"(*high)
-		: "a"(x), "r"(y));
-	#else
-		__asm__ volatile
-		(
-		"mov %2, %%al;"
-		"mul %%bl;"
-		"mov %%al, %0;"
-		"mov %%ah, %1;"
-		: "=g"(*low), "=g"(*high)
-		: "a"(x), "b"(y));
-	#endif
-#else
-	static digit_t const
-		kHalf = sizeof(digit_t) * 4;
-	static digit_t const
-		kHalfMask = ((digit_t)1 << (sizeof(digit_t) * 4)) - 1;
+	ddigit_t const product = (ddigit_t) x * y;
+	*low = (digit_t) product;
+	*high = (digit_t) (product >> DIGIT_BITS);
+}
 
-	digit_t const b = (x & kHalfMask);
-	digit_t const a = (x >> kHalf);
-	digit_t const d = (y & kHalfMask);
-	digit_t const c = (y >> kHalf);
+// operands with fewer digits than this are multiplied with the schoolbook method.
+#ifndef VI_KARATSUBA_THRESHOLD
+#define VI_KARATSUBA_THRESHOLD 32
+#endif
+#if VI_KARATSUBA_THRESHOLD < 2
+#error "VI_KARATSUBA_THRESHOLD must be at least 2."
+#endif
+// balanced operands with at least this many digits use Toom-Cook 3-way.
+#ifndef VI_TOOM3_THRESHOLD
+#define VI_TOOM3_THRESHOLD 192
+#endif
+// balanced operands with at least this many digits use Toom-Cook 4-way.
+#ifndef VI_TOOM4_THRESHOLD
+#define VI_TOOM4_THRESHOLD 400
+#endif
+#if VI_TOOM3_THRESHOLD < 16 || VI_TOOM4_THRESHOLD < 16
+#error "the Toom-Cook thresholds must be at least 16."
+#endif
+#if VI_TOOM4_THRESHOLD < VI_TOOM3_THRESHOLD
+#error "VI_TOOM4_THRESHOLD must not be below VI_TOOM3_THRESHOLD."
+#endif
+// divisors with at least this many digits use Burnikel-Ziegler division,
+// if the quotient has at least VI_BURNIKEL_ZIEGLER_OFFSET digits.
+#ifndef VI_BURNIKEL_ZIEGLER_THRESHOLD
+#define VI_BURNIKEL_ZIEGLER_THRESHOLD 40
+#endif
+#ifndef VI_BURNIKEL_ZIEGLER_OFFSET
+#define VI_BURNIKEL_ZIEGLER_OFFSET 20
+#endif
+#if VI_BURNIKEL_ZIEGLER_THRESHOLD < 2
+#error "VI_BURNIKEL_ZIEGLER_THRESHOLD must be at least 2."
+#endif
+// divisors and quotients with at least this many digits divide via a Newton reciprocal.
+// Burnikel-Ziegler stays ahead for as long as the products fit the NTT.
+#ifndef VI_NEWTON_THRESHOLD
+#define VI_NEWTON_THRESHOLD (268435456 / DIGIT_BITS)
+#endif
+// reciprocals of at most this many digits are seeded by a division.
+#ifndef VI_NEWTON_BASE
+#define VI_NEWTON_BASE 256
+#endif
+#if VI_NEWTON_BASE < 1 || VI_NEWTON_THRESHOLD <= VI_NEWTON_BASE
+#error "VI_NEWTON_THRESHOLD must exceed VI_NEWTON_BASE, which must be at least 1."
+#endif
+// Montgomery moduli with at least this many digits reduce with two products
+// instead of digit by digit.
+#ifndef VI_REDC_THRESHOLD
+#define VI_REDC_THRESHOLD 128
+#endif
+#if VI_REDC_THRESHOLD < 1
+#error "VI_REDC_THRESHOLD must be at least 1."
+#endif
+// operands with at least this many digits use the number theoretic transform.
+#ifndef VI_NTT_THRESHOLD
+#define VI_NTT_THRESHOLD (98304 / DIGIT_BITS)
+#endif
 
-	digit_t const ac = a * c;
-	digit_t const ad = a * d;
-	digit_t const bc = b * c;
-	digit_t const bd = b * d;
+// dest[0..n) = a[0..n) * m, returns the carry digit.
+static digit_t digits_mul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	return n ? vi_mul_1(dest, a, n, m) : 0;
+}
 
-	*low = bd;
-	*high = 0;
+// dest[0..n) += a[0..n) * m, returns the carry digit.
+static digit_t digits_addmul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	return n ? vi_addmul_1(dest, a, n, m) : 0;
+}
 
-	digit_t carry;
-	digit_add(
-		bd,
-		(ad << kHalf),
-		0,
-		low,
-		&carry);
-	digit_t carry2;
-	digit_add(
-		*low,
-		(bc << kHalf),
-		0,
-		low,
-		&carry2);
-	digit_add(
-		ac,
-		ad >> kHalf,
-		carry,
-		high,
-		&carry);
-	digit_add(
-		*high,
-		bc >> kHalf,
-		carry2,
-		high,
-		&carry2);
+// dest[0..an) = a[0..an) + b[0..bn), an >= bn. returns the carry.
+static digit_t digits_add(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(an >= bn);
 
-	assert((carry | carry2) == 0);
-#endif
+	digit_t carry = bn ? vi_add_n(dest, a, b, bn) : 0;
+	for(size_t i = bn; i < an; i++)
+		digit_add(a[i], 0, carry, &dest[i], &carry);
+	return carry;
 }
 
-void vi_mul_create_VarInt(
-	VarInt * dest,
-	VarInt const * srca,
-	VarInt const * srcb)
+// dest[0..an) = a[0..an) - b[0..bn), an >= bn. returns the borrow.
+static digit_t digits_sub(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
 {
-	assert(dest != NULL);
-	assert(srca != NULL);
-	assert(srcb != NULL);
-	assert(dest != srca);
-	assert(dest != srcb);
+	assert(an >= bn);
 
-	vi_create_VarInt(dest);
-	vi_mul_assign_VarInt(dest, srca, srcb);
+	digit_t borrow = bn ? vi_sub_n(dest, a, b, bn) : 0;
+	for(size_t i = bn; i < an; i++)
+		digit_sub(a[i], 0, borrow, &dest[i], &borrow);
+	return borrow;
 }
-void vi_mul_assign_VarInt(
-	VarInt * dest,
-	VarInt const * srca,
-	VarInt const * srcb)
+
+// compares a[0..n) and b[0..n).
+static int digits_compare(
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
 {
-	assert(dest != NULL);
-	assert(srca != NULL);
-	assert(srcb != NULL);
+	for(size_t i = n; i--;)
+		if(a[i] != b[i])
+			return a[i] < b[i] ? -1 : 1;
+	return 0;
+}
 
-	if(dest == srca)
+// returns the length of a[0..n) without leading zero digits.
+static size_t digits_normalise(
+	digit_t const * a,
+	size_t n)
+{
+	while(n && !a[n-1])
+		--n;
+	return n;
+}
+
+// dest[0..n) -= a[0..n) * m, returns the borrow digit.
+static digit_t digits_submul_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
 	{
-		VarInt copy_srca;
-		vi_copy_create_VarInt(&copy_srca, srca);
-		vi_mul_assign_VarInt(dest, &copy_srca, srcb);
-		vi_destroy_VarInt(&copy_srca);
-		return;
+		digit_t low, high, c1, c2;
+		digit_mul(a[i], m, &low, &high);
+		digit_add(low, carry, 0, &low, &c1);
+		digit_sub(dest[i], low, 0, &dest[i], &c2);
+		carry = high + c1 + c2;
 	}
+	return carry;
+}
 
-	if(dest == srcb)
+/* dest[0..n) = a[0..n) / d, returns the remainder.
+dest may be NULL if only the remainder is needed, and may be the same as a. */
+static digit_t digits_div_1(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t d)
+{
+	assert(d != 0);
+
+	ddigit_t rem = 0;
+	for(size_t i = n; i--;)
 	{
-		VarInt copy_srcb;
-		vi_copy_create_VarInt(&copy_srcb, srcb);
-		vi_mul_assign_VarInt(dest, srca, &copy_srcb);
-		vi_destroy_VarInt(&copy_srcb);
-		return;
+		ddigit_t const cur = (rem << DIGIT_BITS) | a[i];
+		if(dest)
+			dest[i] = (digit_t) (cur / d);
+		rem = cur % d;
 	}
+	return (digit_t) rem;
+}
 
-	VarInt const * longer, * shorter;
-
-	if(srca->size >= srcb->size)
+// dest[0..n) = a[0..n) << shift, 0 <= shift < DIGIT_BITS. returns the bits shifted out.
+static digit_t digits_shl(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	unsigned shift)
+{
+	if(!shift)
 	{
-		longer = srca;
-		shorter = srcb;
-	} else
+		for(size_t i = n; i--;)
+			dest[i] = a[i];
+		return 0;
+	}
+
+	digit_t const out = a[n-1] >> (DIGIT_BITS - shift);
+	for(size_t i = n; i-- > 1;)
+		dest[i] = (digit_t) (a[i] << shift) | (a[i-1] >> (DIGIT_BITS - shift));
+	dest[0] = (digit_t) (a[0] << shift);
+	return out;
+}
+
+// dest[0..n) = a[0..n) >> shift, 0 <= shift < DIGIT_BITS.
+static void digits_shr(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	unsigned shift)
+{
+	if(!shift)
 	{
-		longer = srcb;
-		shorter = srca;
+		for(size_t i = 0; i < n; i++)
+			dest[i] = a[i];
+		return;
 	}
 
-	dest->sign = kPos;
-	dest->size = 0;
+	for(size_t i = 0; i + 1 < n; i++)
+		dest[i] = (a[i] >> shift) | (digit_t) (a[i+1] << (DIGIT_BITS - shift));
+	dest[n-1] = a[n-1] >> shift;
+}
+
+/* quo[0..an-bn+1) = a[0..an) / b[0..bn), rem[0..bn) = a % b (Knuth, Algorithm D).
+an >= bn, b must be normalised. Either output may be NULL. The sources
+are copied before any output is written, so the outputs may overlap them. */
+static void digits_divrem(
+	digit_t * quo,
+	digit_t * rem,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(an >= bn);
+	assert(bn && b[bn-1]);
 
-	#pragma omp parallel for shared(dest)
-	for(size_t i = 0; i < shorter->size; i++)
+	if(bn == 1)
 	{
-		VarInt temp;
-		vi_create_VarInt(&temp);
-		vi_calloc_digit(
-			&temp.digits,
-			temp.capacity = i + longer->size + 1);
-		for(size_t x = 0; x < longer->size; x++)
-		{
-			digit_t low, high;
-			digit_mul(
-				shorter->digits[i],
-				longer->digits[x],
-				&low,
-				&high);
-
-			digit_t carry;
-			size_t target = i+x;
-			digit_add(
-				temp.digits[target],
-				low,
-				0,
-				&temp.digits[target],
-				&carry);
-			digit_add(
-				temp.digits[target+1],
-				high,
-				carry,
-				&temp.digits[target+1],
-				&carry);
+		digit_t const r = digits_div_1(quo, a, an, b[0]);
+		if(rem)
+			rem[0] = r;
+		return;
+	}
 
-				target += 2;
+	// shift both operands so that the divisor's top bit is set.
+	unsigned shift = 0;
+	for(digit_t top = b[bn-1]; !(top >> (DIGIT_BITS - 1)); top <<= 1)
+		++shift;
 
-			if(carry)
-				while(!++temp.digits[target])
-				{
-					assert(target < temp.capacity);
-				}
+	ScratchMark const mark = scratch_mark();
+	digit_t * const scratch = scratch_push(an + 1 + bn);
+	digit_t * const un = scratch;
+	digit_t * const vn = scratch + an + 1;
 
-		}
+	digits_shl(vn, b, bn, shift);
+	un[an] = digits_shl(un, a, an, shift);
 
-		for(size_t j = 0; j < temp.capacity; j++)
-			if(temp.digits[j])
-				temp.size = j + 1;
+	digit_t const vtop = vn[bn-1], vnext = vn[bn-2];
+	for(size_t j = an - bn + 1; j--;)
+	{
+		// estimate the quotient digit from the top digits, it is at most 2 too large.
+		ddigit_t const top = ((ddigit_t) un[j+bn] << DIGIT_BITS) | un[j+bn-1];
+		ddigit_t qhat = top / vtop;
+		ddigit_t rhat = top % vtop;
+		while(qhat > DIGIT_MAX
+		|| qhat * vnext > ((rhat << DIGIT_BITS) | un[j+bn-2]))
+		{
+			--qhat;
+			rhat += vtop;
+			if(rhat > DIGIT_MAX)
+				break;
+		}
 
-		#pragma omp critical(accum_mul)
+		// un[j..j+bn] -= qhat * vn, add back once if that was too much.
+		digit_t q = (digit_t) qhat;
+		digit_t borrow;
+		digit_sub(
+			un[j+bn],
+			digits_submul_1(un + j, vn, bn, q),
+			0,
+			&un[j+bn],
+			&borrow);
+		if(borrow)
 		{
-		// dest += temp;
-		vi_add_assign_VarInt(
-			dest,
-			dest,
-			&temp);
+			--q;
+			un[j+bn] += digits_add(un + j, un + j, bn, vn, bn);
 		}
 
-		vi_destroy_VarInt(&temp);
+		if(quo)
+			quo[j] = q;
 	}
 
-	dest->sign = srca->sign != srcb->sign;
+	if(rem)
+		digits_shr(rem, un, bn, shift);
+
+	scratch_pop(mark);
 }
 
-void vi_div_mod_create_VarInt(
-	VarInt * quo,
-	VarInt * rem,
-	VarInt const * srca,
-	VarInt const * srcb)
+// dest[0..an+bn) = a[0..an) * b[0..bn), dest must not overlap the sources.
+static void digits_mul_basecase(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
 {
-	assert(srca != NULL);
-	assert(srcb != NULL);
-	assert(srcb->size != 0 && "cannot divide by zero");
-	if(quo || rem)
-		assert(quo != rem);
-	assert(quo != srca);
-	assert(quo != srcb);
-	assert(rem != srca);
-	assert(rem != srcb);
+	assert(an && bn);
 
-	if(quo)
-		vi_create_VarInt(quo);
-	if(rem)
-		vi_create_VarInt(rem);
-	vi_div_mod_assign_VarInt(quo, rem, srca, srcb);
+	if(an >= bn)
+		vi_mul_basecase(dest, a, an, b, bn);
+	else
+		vi_mul_basecase(dest, b, bn, a, an);
 }
 
-void vi_div_mod_assign_VarInt(
-	VarInt * quo,
-	VarInt * rem,
-	VarInt const * srca,
-	VarInt const * srcb)
+/* dest[0..2n) = a[0..n)^2, dest must not overlap the source.
+Each product a[i] * a[j] with i != j is only computed once and then doubled. */
+static void digits_sqr_basecase(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n)
 {
-	if(quo == NULL)
-	{
-		VarInt _quo = varint_zero;
-		vi_div_mod_assign_VarInt(
-			&_quo,
-			rem,
-			srca,
-			srcb);
-		vi_destroy_VarInt(&_quo);
-		return;
-	}
-	if(rem == NULL)
+	assert(n);
+
+	if(n == 1)
 	{
-		VarInt _rem = varint_zero;
-		vi_div_mod_assign_VarInt(
-			quo,
-			&_rem,
-			srca,
-			srcb);
-		vi_destroy_VarInt(&_rem);
+		digit_mul(a[0], a[0], &dest[0], &dest[1]);
 		return;
 	}
 
-	assert(quo != NULL);
-	assert(rem != NULL);
-	assert(srca != NULL);
-	assert(srcb != NULL);
-	assert(srcb->size != 0 && "cannot divide by zero");
-	assert(quo != rem);
+	// the products above the diagonal.
+	dest[0] = 0;
+	dest[n] = digits_mul_1(dest + 1, a + 1, n - 1, a[0]);
+	for(size_t i = 1; i + 1 < n; i++)
+		dest[n + i] = digits_addmul_1(dest + 2 * i + 1, a + i + 1, n - i - 1, a[i]);
+	dest[2 * n - 1] = 0;
 
-	if(rem == srca || quo == srca)
+	// double them.
+	digit_t high = 0;
+	for(size_t i = 0; i < 2 * n; i++)
 	{
-		VarInt copy_srca;
-		vi_copy_create_VarInt(&copy_srca, srca);
-		vi_div_mod_assign_VarInt(quo, rem, &copy_srca, srcb);
-		vi_destroy_VarInt(&copy_srca);
-		return;
+		digit_t const next = dest[i] >> (DIGIT_BITS - 1);
+		dest[i] = (digit_t) (dest[i] << 1) | high;
+		high = next;
 	}
+	assert(!high);
 
-	if(rem == srcb || quo == srca)
+	// add the diagonal.
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
 	{
-		VarInt copy_srcb;
-		vi_copy_create_VarInt(&copy_srcb, srcb);
-		vi_div_mod_assign_VarInt(quo, rem, srca, &copy_srcb);
-		vi_destroy_VarInt(&copy_srcb);
-		return;
+		digit_t low;
+		digit_mul(a[i], a[i], &low, &high);
+		digit_add(dest[2 * i], low, carry, &dest[2 * i], &carry);
+		digit_add(dest[2 * i + 1], high, carry, &dest[2 * i + 1], &carry);
 	}
+	assert(!carry);
+}
 
-	// quo = 0.
-	quo->size = 0;
-
+// the scratch space (in digits) needed to multiply two n digit numbers.
+static size_t digits_mul_n_scratch(
+	size_t n)
+{
+	// the same order as in digits_mul_n.
+	if(n >= VI_NTT_THRESHOLD && 2 * n <= vi_ntt_max_digits())
+		return 0;
+
+	/* Toom-Cook splits into parts of k digits and multiplies the point values
+	padded to k + 1 digits. It keeps two evaluations of k + 2 digits, and the
+	2 * parts - 1 products and a temporary of 2 * k + 4 digits each. */
+	if(n >= VI_TOOM3_THRESHOLD)
 	{
-		int abs_cmp = vi_abs_compare_VarInt(srca, srcb);
-		if(abs_cmp == 0)
-		{
-			// return +- 1 | 0.
-			rem->size = 0;
-			vi_copy_assign_VarInt(quo, &varint_one);
-			quo->sign = (srca->sign == srcb->sign)
-				? kPos
-				: kNeg;
-			return;
-		} else if(abs_cmp < 0)
-		{
-			// return 0 | srcb.
-			vi_copy_assign_VarInt(rem, srca);
-			return;
-		}
+		size_t const parts = n >= VI_TOOM4_THRESHOLD ? 4 : 3;
+		size_t const k = (n + parts - 1) / parts;
+		return 2 * (k + 2) + 2 * parts * (2 * k + 4) + digits_mul_n_scratch(k + 1);
 	}
 
-	VarInt count_down;
-	vi_copy_create_VarInt(&count_down, srca);
-	// for absolute comparison, we need the same sign.
-	count_down.sign = kPos;
-
-	// start with an initial guess of how many times bigger srca is.
-	int shift = (srca->size - srcb->size + 1) * DIGIT_BITS;
-	VarInt decrease = varint_zero;
-	vi_shl_assign_VarInt(&decrease, srcb, shift);
-	decrease.sign = kPos;
+	if(n < VI_KARATSUBA_THRESHOLD)
+		return 0;
 
-	// dummy for reuse, has to be reassigned before each use.
-	VarInt quo_inc = varint_zero;
+	size_t const k = n - n / 2;
+	return 4 * k + 2 + digits_mul_n_scratch(k);
+}
 
-	for(;;)
+static void digits_mul_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n,
+	digit_t * scratch);
+
+static void digits_sqr_n(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t * scratch);
+
+/* dest[0..2n) = a[0..n) * b[0..n) using Karatsuba's method.
+With a = a1 * B^h + a0 and b = b1 * B^h + b0, the middle product
+a1 * b0 + a0 * b1 = a0 * b0 + a1 * b1 - (a1 - a0) * (b1 - b0). */
+static void digits_mul_karatsuba(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n,
+	digit_t * scratch)
+{
+	size_t const h = n / 2;
+	size_t const k = n - h;
+
+	digit_t * const da = scratch;
+	digit_t * const db = scratch + k;
+	digit_t * const mid = scratch;
+	digit_t * const t = scratch + 2 * k + 1;
+	digit_t * const rest = scratch + 4 * k + 2;
+
+	// da = |a1 - a0|, db = |b1 - b0|, the high halves have k >= h digits.
+	int negative = 0;
+	if((k > h && a[n-1]) || digits_compare(a + h, a, h) >= 0)
+	{
+		digits_sub(da, a + h, k, a, h);
+	} else
+	{
+		digits_sub(da, a, h, a + h, h);
+		if(k > h)
+			da[h] = 0;
+		negative = !negative;
+	}
+	if((k > h && b[n-1]) || digits_compare(b + h, b, h) >= 0)
+	{
+		digits_sub(db, b + h, k, b, h);
+	} else
 	{
-		// sanity check.
-		assert(shift >= 0);
-		assert(count_down.sign == kPos);
+		digits_sub(db, b, h, b + h, h);
+		if(k > h)
+			db[h] = 0;
+		negative = !negative;
+	}
 
-		// check whether we should continue.
-		int const compare = vi_compare_VarInt(&decrease, &count_down);
+	digits_mul_n(t, da, db, k, rest);
+	digits_mul_n(dest, a, b, h, rest);
+	digits_mul_n(dest + 2 * h, a + h, b + h, k, rest);
 
-		if(compare == 0) // finished and no remainder?
-		{
-			// rem = 0.
-			rem->size = 0;
+	// mid = a0 * b0 + a1 * b1 -+ (a1 - a0) * (b1 - b0).
+	mid[2 * k] = digits_add(mid, dest + 2 * h, 2 * k, dest, 2 * h);
+	if(negative)
+	{
+		mid[2 * k] += digits_add(mid, mid, 2 * k, t, 2 * k);
+	} else
+	{
+		mid[2 * k] -= digits_sub(mid, mid, 2 * k, t, 2 * k);
+	}
 
-			// quo += 2 ^ shift.
-			vi_shl_assign_VarInt(&decrease, &varint_one, shift);
-			vi_add_assign_VarInt(quo, quo, &decrease);
+	size_t const mid_size = digits_normalise(mid, 2 * k + 1);
+	assert(mid_size <= 2 * n - h);
+	digit_t const carry = digits_add(dest + h, dest + h, 2 * n - h, mid, mid_size);
+	assert(!carry);
+	(void) carry;
+}
 
-			break;
-		} else if(compare > 0) // our current decrease amount is larget than count_down?
+/* dest[0..2n) = a[0..n)^2 using Karatsuba's method.
+The middle product 2 * a1 * a0 = a0^2 + a1^2 - (a1 - a0)^2. */
+static void digits_sqr_karatsuba(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t * scratch)
+{
+	size_t const h = n / 2;
+	size_t const k = n - h;
+
+	digit_t * const da = scratch;
+	digit_t * const mid = scratch;
+	digit_t * const t = scratch + 2 * k + 1;
+	digit_t * const rest = scratch + 4 * k + 2;
+
+	// da = |a1 - a0|.
+	if((k > h && a[n-1]) || digits_compare(a + h, a, h) >= 0)
+	{
+		digits_sub(da, a + h, k, a, h);
+	} else
+	{
+		digits_sub(da, a, h, a + h, h);
+		if(k > h)
+			da[h] = 0;
+	}
+
+	digits_sqr_n(t, da, k, rest);
+	digits_sqr_n(dest, a, h, rest);
+	digits_sqr_n(dest + 2 * h, a + h, k, rest);
+
+	// mid = a0^2 + a1^2 - (a1 - a0)^2.
+	mid[2 * k] = digits_add(mid, dest + 2 * h, 2 * k, dest, 2 * h);
+	mid[2 * k] -= digits_sub(mid, mid, 2 * k, t, 2 * k);
+
+	size_t const mid_size = digits_normalise(mid, 2 * k + 1);
+	assert(mid_size <= 2 * n - h);
+	digit_t const carry = digits_add(dest + h, dest + h, 2 * n - h, mid, mid_size);
+	assert(!carry);
+	(void) carry;
+}
+
+// dest = src * m.
+static void internal_mul_digit_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	digit_t m)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+
+	if(!src->size || !m)
+	{
+		dest->size = 0;
+		dest->sign = kPos;
+		return;
+	}
+
+	if(dest->capacity < src->size + 1)
+	{
+		vi_realloc_digit(
+			&dest->digits,
+			dest->capacity = src->size + 1);
+	}
+
+	digit_t const carry = digits_mul_1(dest->digits, src->digits, src->size, m);
+	dest->digits[src->size] = carry;
+	dest->size = src->size + !!carry;
+	dest->sign = src->sign;
+}
+
+// dest = src / d, where src must be a multiple of d.
+static void internal_divexact_digit_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	digit_t d)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+
+	if(dest->capacity < src->size)
+	{
+		vi_realloc_digit(
+			&dest->digits,
+			dest->capacity = src->size);
+	}
+
+	digit_t const rem = digits_div_1(dest->digits, src->digits, src->size, d);
+	assert(rem == 0 && "inexact division.");
+	(void) rem;
+
+	dest->size = digits_normalise(dest->digits, src->size);
+	dest->sign = dest->size ? src->sign : kPos;
+}
+
+// read-only view of a digit range, must not be destroyed or assigned to.
+static VarInt digits_view(
+	digit_t const * digits,
+	size_t size)
+{
+	VarInt view = {
+		(digit_t *) digits,
+		digits_normalise(digits, size),
+		0,
+		kPos
+	};
+	return view;
+}
+
+// splits a[0..n) into count views of k digits each, the last one gets the rest.
+static void toom_split(
+	VarInt * parts,
+	digit_t const * a,
+	size_t n,
+	size_t k,
+	size_t count)
+{
+	for(size_t i = 0; i + 1 < count; i++)
+		parts[i] = digits_view(a + i * k, k);
+	parts[count - 1] = digits_view(a + (count - 1) * k, n - (count - 1) * k);
+}
+
+// dest = sum(parts[i] * point^i).
+static void toom_evaluate(
+	VarInt * dest,
+	VarInt const * parts,
+	size_t count,
+	int point)
+{
+	vi_copy_assign_VarInt(dest, &parts[count - 1]);
+	for(size_t i = count - 1; i--;)
+	{
+		internal_mul_digit_VarInt(
+			dest,
+			dest,
+			(digit_t) (point < 0 ? -point : point));
+		if(point < 0 && dest->size)
+			dest->sign = !dest->sign;
+		vi_add_assign_VarInt(dest, dest, &parts[i]);
+	}
+}
+
+// dest[0..2n) = sum(coeffs[i] * B^(i*k)), all coefficients are non-negative.
+static void toom_recompose(
+	digit_t * dest,
+	size_t n,
+	VarInt const * coeffs,
+	size_t count,
+	size_t k)
+{
+	for(size_t i = 0; i < 2 * n; i++)
+		dest[i] = 0;
+
+	for(size_t i = 0; i < count; i++)
+	{
+		assert(!coeffs[i].size || coeffs[i].sign == kPos);
+		if(!coeffs[i].size)
+			continue;
+
+		assert(i * k + coeffs[i].size <= 2 * n);
+		digit_t const carry = digits_add(
+			dest + i * k,
+			dest + i * k,
+			2 * n - i * k,
+			coeffs[i].digits,
+			coeffs[i].size);
+		assert(!carry);
+		(void) carry;
+	}
+}
+
+// an empty VarInt over capacity scratch digits, it must not be destroyed.
+static VarInt scratch_VarInt(
+	digit_t * digits,
+	size_t capacity)
+{
+	VarInt var = { digits, 0, capacity, kPos };
+	return var;
+}
+
+// value = ea * eb, both zero padded to m digits. If eb is ea, it is squared.
+static void toom_multiply(
+	VarInt * value,
+	VarInt * ea,
+	VarInt * eb,
+	size_t m,
+	digit_t * scratch)
+{
+	assert(ea->size <= m && eb->size <= m);
+	assert(value->capacity >= 2 * m);
+
+	for(size_t i = ea->size; i < m; i++)
+		ea->digits[i] = 0;
+	for(size_t i = eb->size; i < m; i++)
+		eb->digits[i] = 0;
+
+	if(ea == eb)
+		digits_sqr_n(value->digits, ea->digits, m, scratch);
+	else
+		digits_mul_n(value->digits, ea->digits, eb->digits, m, scratch);
+
+	value->size = digits_normalise(value->digits, 2 * m);
+	value->sign = value->size && ea->sign != eb->sign ? kNeg : kPos;
+}
+
+/* values[i] = a(points[i]) * b(points[i]), the point at infinity is the last one.
+If pa and pb are the same, the values are squared instead. The evaluations take
+2 * (k + 2) digits of scratch, the products of k + 1 digits use the rest. */
+static void toom_pointwise(
+	VarInt * values,
+	VarInt const * pa,
+	VarInt const * pb,
+	size_t parts,
+	int const * points,
+	size_t count,
+	size_t k,
+	digit_t * scratch)
+{
+	VarInt ea = scratch_VarInt(scratch, k + 2);
+	VarInt eb = scratch_VarInt(scratch + k + 2, k + 2);
+	VarInt * const pe = pa == pb ? &ea : &eb;
+	digit_t * const rest = scratch + 2 * (k + 2);
+
+	for(size_t i = 0; i < count + 2; i++)
+	{
+		// the points 0 and infinity take the first and the last part.
+		if(!i || i == count + 1)
+		{
+			size_t const part = i ? parts - 1 : 0;
+			vi_copy_assign_VarInt(&ea, &pa[part]);
+			if(pe != &ea)
+				vi_copy_assign_VarInt(&eb, &pb[part]);
+		} else
+		{
+			toom_evaluate(&ea, pa, parts, points[i - 1]);
+			if(pe != &ea)
+				toom_evaluate(&eb, pb, parts, points[i - 1]);
+		}
+		toom_multiply(&values[i], &ea, pe, k + 1, rest);
+	}
+}
+
+/* dest[0..2n) = a[0..n) * b[0..n) using Toom-Cook 3-way.
+The product polynomial is evaluated at 0, 1, -1, 2 and infinity. */
+static void digits_mul_toom3(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n,
+	digit_t * scratch)
+{
+	static int const points[] = { 1, -1, 2 };
+	size_t const k = (n + 2) / 3;
+
+	VarInt pa[3], pb[3];
+	toom_split(pa, a, n, k, 3);
+	toom_split(pb, b, n, k, 3);
+
+	// the values and the temporary take 2 * k + 4 digits each.
+	VarInt v[5];
+	for(size_t i = 0; i < 5; i++)
+		v[i] = scratch_VarInt(scratch + i * (2 * k + 4), 2 * k + 4);
+	VarInt t = scratch_VarInt(scratch + 5 * (2 * k + 4), 2 * k + 4);
+	toom_pointwise(v, pa, a == b ? pa : pb, 3, points, 3, k, scratch + 6 * (2 * k + 4));
+
+	VarInt * const v0 = &v[0], * const v1 = &v[1], * const vm1 = &v[2];
+	VarInt * const v2 = &v[3], * const vinf = &v[4];
+
+	// vm1 = c1 + c3, v1 = c2.
+	vi_sub_assign_VarInt(&t, v1, vm1);
+	vi_add_assign_VarInt(v1, v1, vm1);
+	vi_shr_assign_VarInt(vm1, &t, 1);
+	vi_shr_assign_VarInt(v1, v1, 1);
+	vi_sub_assign_VarInt(v1, v1, v0);
+	vi_sub_assign_VarInt(v1, v1, vinf);
+
+	// v2 = c1 + 4 c3.
+	vi_sub_assign_VarInt(v2, v2, v0);
+	vi_shl_assign_VarInt(&t, v1, 2);
+	vi_sub_assign_VarInt(v2, v2, &t);
+	vi_shl_assign_VarInt(&t, vinf, 4);
+	vi_sub_assign_VarInt(v2, v2, &t);
+	vi_shr_assign_VarInt(v2, v2, 1);
+
+	// v2 = c3, vm1 = c1.
+	vi_sub_assign_VarInt(v2, v2, vm1);
+	internal_divexact_digit_VarInt(v2, v2, 3);
+	vi_sub_assign_VarInt(vm1, vm1, v2);
+
+	VarInt const coeffs[5] = { *v0, *vm1, *v1, *v2, *vinf };
+	toom_recompose(dest, n, coeffs, 5, k);
+}
+
+/* dest[0..2n) = a[0..n) * b[0..n) using Toom-Cook 4-way.
+The product polynomial is evaluated at 0, 1, -1, 2, -2, 3 and infinity. */
+static void digits_mul_toom4(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n,
+	digit_t * scratch)
+{
+	static int const points[] = { 1, -1, 2, -2, 3 };
+	size_t const k = (n + 3) / 4;
+
+	VarInt pa[4], pb[4];
+	toom_split(pa, a, n, k, 4);
+	toom_split(pb, b, n, k, 4);
+
+	// the values and the temporary take 2 * k + 4 digits each.
+	VarInt v[7];
+	for(size_t i = 0; i < 7; i++)
+		v[i] = scratch_VarInt(scratch + i * (2 * k + 4), 2 * k + 4);
+	VarInt t = scratch_VarInt(scratch + 7 * (2 * k + 4), 2 * k + 4);
+	toom_pointwise(v, pa, a == b ? pa : pb, 4, points, 5, k, scratch + 8 * (2 * k + 4));
+
+	VarInt * const v0 = &v[0], * const v1 = &v[1], * const vm1 = &v[2];
+	VarInt * const v2 = &v[3], * const vm2 = &v[4], * const v3 = &v[5];
+	VarInt * const vinf = &v[6];
+
+	// vm1 = c1 + c3 + c5, v1 = c2 + c4.
+	vi_sub_assign_VarInt(&t, v1, vm1);
+	vi_add_assign_VarInt(v1, v1, vm1);
+	vi_shr_assign_VarInt(vm1, &t, 1);
+	vi_shr_assign_VarInt(v1, v1, 1);
+	vi_sub_assign_VarInt(v1, v1, v0);
+	vi_sub_assign_VarInt(v1, v1, vinf);
+
+	// vm2 = c1 + 4 c3 + 16 c5, v2 = 4 c2 + 16 c4.
+	vi_sub_assign_VarInt(&t, v2, vm2);
+	vi_add_assign_VarInt(v2, v2, vm2);
+	vi_shr_assign_VarInt(vm2, &t, 2);
+	vi_shr_assign_VarInt(v2, v2, 1);
+	vi_sub_assign_VarInt(v2, v2, v0);
+	vi_shl_assign_VarInt(&t, vinf, 6);
+	vi_sub_assign_VarInt(v2, v2, &t);
+
+	// v2 = c4, v1 = c2.
+	vi_shl_assign_VarInt(&t, v1, 2);
+	vi_sub_assign_VarInt(v2, v2, &t);
+	vi_shr_assign_VarInt(v2, v2, 2);
+	internal_divexact_digit_VarInt(v2, v2, 3);
+	vi_sub_assign_VarInt(v1, v1, v2);
+
+	// v3 = c1 + 9 c3 + 81 c5.
+	vi_sub_assign_VarInt(v3, v3, v0);
+	internal_mul_digit_VarInt(&t, v1, 9);
+	vi_sub_assign_VarInt(v3, v3, &t);
+	internal_mul_digit_VarInt(&t, v2, 9);
+	internal_mul_digit_VarInt(&t, &t, 9);
+	vi_sub_assign_VarInt(v3, v3, &t);
+	internal_mul_digit_VarInt(&t, vinf, 9);
+	internal_mul_digit_VarInt(&t, &t, 9);
+	internal_mul_digit_VarInt(&t, &t, 9);
+	vi_sub_assign_VarInt(v3, v3, &t);
+	internal_divexact_digit_VarInt(v3, v3, 3);
+
+	// v3 = c3 + 13 c5, vm2 = c3 + 5 c5.
+	vi_sub_assign_VarInt(v3, v3, vm2);
+	internal_divexact_digit_VarInt(v3, v3, 5);
+	vi_sub_assign_VarInt(vm2, vm2, vm1);
+	internal_divexact_digit_VarInt(vm2, vm2, 3);
+
+	// v3 = c5, vm2 = c3, vm1 = c1.
+	vi_sub_assign_VarInt(v3, v3, vm2);
+	vi_shr_assign_VarInt(v3, v3, 3);
+	internal_mul_digit_VarInt(&t, v3, 5);
+	vi_sub_assign_VarInt(vm2, vm2, &t);
+	vi_sub_assign_VarInt(vm1, vm1, vm2);
+	vi_sub_assign_VarInt(vm1, vm1, v3);
+
+	VarInt const coeffs[7] = { *v0, *vm1, *v1, *vm2, *v2, *v3, *vinf };
+	toom_recompose(dest, n, coeffs, 7, k);
+}
+
+// dest[0..2n) = a[0..n) * b[0..n).
+static void digits_mul_n(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n,
+	digit_t * scratch)
+{
+	if(a == b)
+		digits_sqr_n(dest, a, n, scratch);
+	else if(n >= VI_NTT_THRESHOLD && 2 * n <= vi_ntt_max_digits())
+		vi_mul_ntt(dest, a, n, b, n);
+	else if(n >= VI_TOOM4_THRESHOLD)
+		digits_mul_toom4(dest, a, b, n, scratch);
+	else if(n >= VI_TOOM3_THRESHOLD)
+		digits_mul_toom3(dest, a, b, n, scratch);
+	else if(n >= VI_KARATSUBA_THRESHOLD)
+		digits_mul_karatsuba(dest, a, b, n, scratch);
+	else
+		digits_mul_basecase(dest, a, n, b, n);
+}
+
+// dest[0..2n) = a[0..n)^2.
+static void digits_sqr_n(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t * scratch)
+{
+	if(n >= VI_NTT_THRESHOLD && 2 * n <= vi_ntt_max_digits())
+		vi_mul_ntt(dest, a, n, a, n);
+	else if(n >= VI_TOOM4_THRESHOLD)
+		digits_mul_toom4(dest, a, a, n, scratch);
+	else if(n >= VI_TOOM3_THRESHOLD)
+		digits_mul_toom3(dest, a, a, n, scratch);
+	else if(n >= VI_KARATSUBA_THRESHOLD)
+		digits_sqr_karatsuba(dest, a, n, scratch);
+	else
+		digits_sqr_basecase(dest, a, n);
+}
+
+// dest[0..2n) = a[0..n)^2, dest must not overlap the source.
+static void digits_sqr(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n)
+{
+	assert(n != 0);
+
+	size_t const scratch_size = digits_mul_n_scratch(n);
+	if(!scratch_size)
+	{
+		digits_sqr_n(dest, a, n, NULL);
+		return;
+	}
+
+	ScratchMark const mark = scratch_mark();
+	digits_sqr_n(dest, a, n, scratch_push(scratch_size));
+	scratch_pop(mark);
+}
+
+/* dest[0..an+bn) = a[0..an) * b[0..bn), an >= bn.
+Unbalanced operands are multiplied in bn sized slices of a. */
+static void digits_mul(
+	digit_t * dest,
+	digit_t const * a,
+	size_t an,
+	digit_t const * b,
+	size_t bn)
+{
+	assert(an >= bn);
+	assert(bn != 0);
+
+	if(bn < VI_KARATSUBA_THRESHOLD)
+	{
+		digits_mul_basecase(dest, a, an, b, bn);
+		return;
+	}
+
+	if(bn >= VI_NTT_THRESHOLD && an + bn <= vi_ntt_max_digits())
+	{
+		vi_mul_ntt(dest, a, an, b, bn);
+		return;
+	}
+
+	ScratchMark const mark = scratch_mark();
+	digit_t * const scratch = scratch_push(digits_mul_n_scratch(bn) + 2 * bn);
+	digit_t * const slice = scratch + digits_mul_n_scratch(bn);
+
+	digits_mul_n(dest, a, b, bn, scratch);
+	for(size_t i = bn; i < an; i += bn)
+	{
+		size_t const len = an - i < bn ? an - i : bn;
+		if(len == bn)
+			digits_mul_n(slice, a + i, b, bn, scratch);
+		else
+			digits_mul(slice, b, bn, a + i, len);
+
+		// the upper bn digits of dest are not yet written.
+		for(size_t j = 0; j < len; j++)
+			dest[i + bn + j] = 0;
+		digit_t const carry = digits_add(dest + i, dest + i, bn + len, slice, bn + len);
+		assert(!carry);
+		(void) carry;
+	}
+
+	scratch_pop(mark);
+}
+
+void vi_mul_create_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	assert(dest != NULL);
+	assert(srca != NULL);
+	assert(srcb != NULL);
+	assert(dest != srca);
+	assert(dest != srcb);
+
+	vi_create_VarInt(dest);
+	vi_mul_assign_VarInt(dest, srca, srcb);
+}
+void vi_mul_assign_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	assert(dest != NULL);
+	assert(srca != NULL);
+	assert(srcb != NULL);
+
+	if(srca == srcb)
+	{
+		vi_sqr_assign_VarInt(dest, srca);
+		return;
+	}
+
+	if(!srca->size || !srcb->size)
+	{
+		dest->size = 0;
+		dest->sign = kPos;
+		return;
+	}
+
+	VarInt const * longer, * shorter;
+
+	if(srca->size >= srcb->size)
+	{
+		longer = srca;
+		shorter = srcb;
+	} else
+	{
+		longer = srcb;
+		shorter = srca;
+	}
+
+	sign_t const sign = srca->sign != srcb->sign;
+	size_t const size = longer->size + shorter->size;
+
+	// the product is built in a separate buffer if dest is too small, or on the
+	// scratch stack and copied if dest is also a source.
+	if(dest->capacity < size)
+	{
+		digit_t * product = NULL;
+		vi_malloc(
+			(void**)&product,
+			sizeof(digit_t),
+			size);
+
+		digits_mul(
+			product,
+			longer->digits,
+			longer->size,
+			shorter->digits,
+			shorter->size);
+
+		if(dest->digits)
+			vi_free_digit(&dest->digits);
+		dest->digits = product;
+		dest->capacity = size;
+	} else if(dest == srca || dest == srcb)
+	{
+		ScratchMark const mark = scratch_mark();
+		digit_t * const product = scratch_push(size);
+
+		digits_mul(
+			product,
+			longer->digits,
+			longer->size,
+			shorter->digits,
+			shorter->size);
+
+		memcpy(dest->digits, product, size * sizeof(digit_t));
+		scratch_pop(mark);
+	} else
+	{
+		digits_mul(
+			dest->digits,
+			longer->digits,
+			longer->size,
+			shorter->digits,
+			shorter->size);
+	}
+
+	dest->size = digits_normalise(dest->digits, size);
+	dest->sign = sign;
+}
+
+void vi_sqr_create_VarInt(
+	VarInt * dest,
+	VarInt const * src)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+	assert(dest != src);
+
+	vi_create_VarInt(dest);
+	vi_sqr_assign_VarInt(dest, src);
+}
+
+void vi_sqr_assign_VarInt(
+	VarInt * dest,
+	VarInt const * src)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+
+	if(!src->size)
+	{
+		dest->size = 0;
+		dest->sign = kPos;
+		return;
+	}
+
+	size_t const size = 2 * src->size;
+
+	// the square is built in a separate buffer if dest is too small, or on the
+	// scratch stack and copied if dest is also the source.
+	if(dest->capacity < size)
+	{
+		digit_t * square = NULL;
+		vi_malloc(
+			(void**)&square,
+			sizeof(digit_t),
+			size);
+
+		digits_sqr(square, src->digits, src->size);
+
+		if(dest->digits)
+			vi_free_digit(&dest->digits);
+		dest->digits = square;
+		dest->capacity = size;
+	} else if(dest == src)
+	{
+		ScratchMark const mark = scratch_mark();
+		digit_t * const square = scratch_push(size);
+
+		digits_sqr(square, src->digits, src->size);
+
+		memcpy(dest->digits, square, size * sizeof(digit_t));
+		scratch_pop(mark);
+	} else
+	{
+		digits_sqr(dest->digits, src->digits, src->size);
+	}
+
+	dest->size = digits_normalise(dest->digits, size);
+	dest->sign = kPos;
+}
+
+void vi_div_mod_create_VarInt(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	assert(srca != NULL);
+	assert(srcb != NULL);
+	assert(srcb->size != 0 && "cannot divide by zero");
+	if(quo || rem)
+		assert(quo != rem);
+	assert(quo != srca);
+	assert(quo != srcb);
+	assert(rem != srca);
+	assert(rem != srcb);
+
+	if(quo)
+		vi_create_VarInt(quo);
+	if(rem)
+		vi_create_VarInt(rem);
+	vi_div_mod_assign_VarInt(quo, rem, srca, srcb);
+}
+
+// quo = |srca| / |srcb|, rem = |srca| % |srcb| using Algorithm D. Either output may be NULL.
+static void internal_div_mod_VarInt(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	assert(srcb->size != 0);
+
+	if(srca->size < srcb->size
+	|| (srca != srcb && vi_abs_compare_VarInt(srca, srcb) < 0))
+	{
+		if(rem && rem != srca)
+			vi_copy_assign_VarInt(rem, srca);
+		if(rem)
+			rem->sign = kPos;
+		if(quo)
+		{
+			quo->size = 0;
+			quo->sign = kPos;
+		}
+		return;
+	}
+
+	size_t const quo_size = srca->size - srcb->size + 1;
+	size_t const rem_size = srcb->size;
+
+	// reserve first, as the sources may be the same as the outputs.
+	if(quo && quo->capacity < quo_size)
+	{
+		vi_realloc_digit(
+			&quo->digits,
+			quo->capacity = quo_size);
+	}
+	if(rem && rem->capacity < rem_size)
+	{
+		vi_realloc_digit(
+			&rem->digits,
+			rem->capacity = rem_size);
+	}
+
+	digits_divrem(
+		quo ? quo->digits : NULL,
+		rem ? rem->digits : NULL,
+		srca->digits,
+		srca->size,
+		srcb->digits,
+		srcb->size);
+
+	if(quo)
+	{
+		quo->size = digits_normalise(quo->digits, quo_size);
+		quo->sign = kPos;
+	}
+	if(rem)
+	{
+		rem->size = digits_normalise(rem->digits, rem_size);
+		rem->sign = kPos;
+	}
+}
+
+// view of the digits [from, from + count) of this.
+static VarInt block_view(
+	VarInt const * this,
+	size_t from,
+	size_t count)
+{
+	if(from >= this->size)
+		return digits_view(this->digits, 0);
+
+	size_t const available = this->size - from;
+	return digits_view(
+		this->digits + from,
+		count < available ? count : available);
+}
+
+// dest = high * B^n + low, where low < B^n.
+static void internal_concat_VarInt(
+	VarInt * dest,
+	VarInt const * high,
+	VarInt const * low,
+	size_t n)
+{
+	assert(dest != high && dest != low);
+	assert(low->size <= n);
+
+	size_t const size = high->size ? n + high->size : low->size;
+	if(dest->capacity < size)
+	{
+		vi_realloc_digit(
+			&dest->digits,
+			dest->capacity = size);
+	}
+
+	for(size_t i = 0; i < low->size; i++)
+		dest->digits[i] = low->digits[i];
+	for(size_t i = low->size; i < size && i < n; i++)
+		dest->digits[i] = 0;
+	for(size_t i = 0; i < high->size; i++)
+		dest->digits[n + i] = high->digits[i];
+
+	dest->size = size;
+	dest->sign = kPos;
+}
+
+static void bz_div_3n_2n(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * a,
+	VarInt const * b,
+	size_t n);
+
+/* quo, rem = a / b, where b has n normalised digits and a < b * B^n.
+The division is split into two 3 by 2 block divisions. */
+static void bz_div_2n_1n(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * a,
+	VarInt const * b,
+	size_t n)
+{
+	if(n % 2 || n < VI_BURNIKEL_ZIEGLER_THRESHOLD)
+	{
+		internal_div_mod_VarInt(quo, rem, a, b);
+		return;
+	}
+
+	size_t const half = n / 2;
+	VarInt const a123 = block_view(a, half, 3 * half);
+	VarInt const a4 = block_view(a, 0, half);
+
+	VarInt q1 = varint_zero, q2 = varint_zero;
+	VarInt r = varint_zero, t = varint_zero;
+
+	bz_div_3n_2n(&q1, &r, &a123, b, half);
+	internal_concat_VarInt(&t, &r, &a4, half);
+	bz_div_3n_2n(&q2, rem, &t, b, half);
+	internal_concat_VarInt(quo, &q1, &q2, half);
+
+	vi_destroy_VarInt(&q1);
+	vi_destroy_VarInt(&q2);
+	vi_destroy_VarInt(&r);
+	vi_destroy_VarInt(&t);
+}
+
+/* quo, rem = a / b, where b has 2n normalised digits and a < b * B^n.
+The quotient is estimated from the top blocks and corrected at most twice. */
+static void bz_div_3n_2n(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * a,
+	VarInt const * b,
+	size_t n)
+{
+	VarInt const a1 = block_view(a, 2 * n, n);
+	VarInt const a12 = block_view(a, n, 2 * n);
+	VarInt const a3 = block_view(a, 0, n);
+	VarInt const b1 = block_view(b, n, n);
+	VarInt const b2 = block_view(b, 0, n);
+
+	VarInt r1 = varint_zero, d = varint_zero;
+
+	if(vi_abs_compare_VarInt(&a1, &b1) < 0)
+	{
+		bz_div_2n_1n(quo, &r1, &a12, &b1, n);
+	} else
+	{
+		// quo = B^n - 1, r1 = a12 - quo * b1 = a12 - b1 * B^n + b1.
+		if(quo->capacity < n)
 		{
-			if(shift > 0) // we can still reduce our decrease amount.
-			{
-				--shift;
-				vi_shr_assign_VarInt(&decrease, &decrease, 1);
-			} else // we have remainder, and finished.
-			{
-				// rem = count_down.
-				vi_copy_assign_VarInt(rem, &count_down);
-				break;
-			}
-		} else // we are not yet finished.
+			vi_realloc_digit(
+				&quo->digits,
+				quo->capacity = n);
+		}
+		for(size_t i = 0; i < n; i++)
+			quo->digits[i] = DIGIT_MAX;
+		quo->size = n;
+		quo->sign = kPos;
+
+		internal_concat_VarInt(&d, &b1, &varint_zero, n);
+		vi_sub_assign_VarInt(&r1, &a12, &d);
+		vi_add_assign_VarInt(&r1, &r1, &b1);
+	}
+
+	// rem = r1 * B^n + a3 - quo * b2.
+	vi_mul_assign_VarInt(&d, quo, &b2);
+	internal_concat_VarInt(rem, &r1, &a3, n);
+	vi_sub_assign_VarInt(rem, rem, &d);
+
+	while(rem->size && rem->sign == kNeg)
+	{
+		vi_add_assign_VarInt(rem, rem, b);
+		vi_dec_assign_VarInt(quo, quo);
+	}
+
+	vi_destroy_VarInt(&r1);
+	vi_destroy_VarInt(&d);
+}
+
+static size_t internal_bit_length_VarInt(
+	VarInt const * this)
+{
+	if(!this->size)
+		return 0;
+
+	size_t bits = (this->size - 1) * DIGIT_BITS;
+	for(digit_t top = this->digits[this->size-1]; top; top >>= 1)
+		++bits;
+	return bits;
+}
+
+/* quo = |srca| / |srcb|, rem = |srca| % |srcb| using Burnikel-Ziegler division.
+The divisor is padded to n = j * 2^k digits, so that halving n repeatedly
+ends below the threshold, and the dividend is divided in blocks of n digits. */
+static void internal_div_mod_bz_VarInt(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	size_t m = 1;
+	while(m <= srcb->size / VI_BURNIKEL_ZIEGLER_THRESHOLD)
+		m <<= 1;
+	size_t const n = (srcb->size + m - 1) / m * m;
+
+	// normalise the divisor to exactly n digits with its top bit set.
+	int const shift = (int) (n * DIGIT_BITS - internal_bit_length_VarInt(srcb));
+	VarInt a = varint_zero, b = varint_zero;
+	vi_shl_assign_VarInt(&b, srcb, shift);
+	vi_shl_assign_VarInt(&a, srca, shift);
+	a.sign = b.sign = kPos;
+
+	// the top block must be smaller than b, so one bit is left free.
+	size_t t = (internal_bit_length_VarInt(&a) + n * DIGIT_BITS) / (n * DIGIT_BITS);
+	if(t < 2)
+		t = 2;
+
+	VarInt q = varint_zero, r = varint_zero, z = varint_zero;
+	VarInt const top = block_view(&a, (t - 2) * n, 2 * n);
+	vi_copy_assign_VarInt(&z, &top);
+
+	if(quo)
+	{
+		if(quo->capacity < (t - 1) * n)
 		{
-			// count_down -= decrease.
-			vi_sub_assign_VarInt(&count_down, &count_down, &decrease);
-			// decrease >>= 1.
-			vi_shr_assign_VarInt(&decrease, &decrease, 1);
-			// quo += 1 << shift.
-			vi_shl_assign_VarInt(&quo_inc, &varint_one, shift);
-			vi_add_assign_VarInt(quo, quo, &quo_inc);
-
-			if(shift > 0) // can we still continue?
-			{
-				--shift;
-			} else // we (possibly) have a remainder and we finished.
-			{
-				// rem = count_down.
-				vi_copy_assign_VarInt(rem, &count_down);
+			vi_realloc_digit(
+				&quo->digits,
+				quo->capacity = (t - 1) * n);
+		}
+		quo->size = (t - 1) * n;
+		quo->sign = kPos;
+	}
 
-				break;
-			}
+	for(size_t i = t - 1; i--;)
+	{
+		bz_div_2n_1n(&q, &r, &z, &b, n);
+
+		if(quo)
+		{
+			assert(q.size <= n);
+			for(size_t j = 0; j < q.size; j++)
+				quo->digits[i * n + j] = q.digits[j];
+			for(size_t j = q.size; j < n; j++)
+				quo->digits[i * n + j] = 0;
+		}
+
+		if(i)
+		{
+			VarInt const next = block_view(&a, (i - 1) * n, n);
+			internal_concat_VarInt(&z, &r, &next, n);
+		}
+	}
+
+	if(quo)
+		quo->size = digits_normalise(quo->digits, quo->size);
+	if(rem)
+		vi_shr_assign_VarInt(rem, &r, shift);
+
+	vi_destroy_VarInt(&a);
+	vi_destroy_VarInt(&b);
+	vi_destroy_VarInt(&q);
+	vi_destroy_VarInt(&r);
+	vi_destroy_VarInt(&z);
+}
+
+/* x = floor(2^(2 * bits) / d), where d has exactly the given number of bits.
+Each Newton step x += x * (2^(2 * bits) - d * x) / 2^(2 * bits) doubles the
+precision of the reciprocal of d's top half. The inner steps carry a few
+guard bits and approach the reciprocal from below, so the result is at
+most a few units too small unless exact is set, which corrects it with
+the remainder. */
+static void internal_reciprocal_VarInt(
+	VarInt * x,
+	VarInt const * d,
+	size_t bits,
+	int exact)
+{
+	VarInt e = varint_zero;
+	vi_shl_assign_VarInt(&e, &varint_one, (int) (2 * bits));
+
+	// the seed divides by a divisor below VI_NEWTON_THRESHOLD, which cannot recurse.
+	if(bits <= (size_t) VI_NEWTON_BASE * DIGIT_BITS)
+	{
+		vi_div_mod_assign_VarInt(x, NULL, &e, d);
+		vi_destroy_VarInt(&e);
+		return;
+	}
+
+	size_t const half = bits / 2 + 4;
+	int const shift = (int) (bits - half);
+	VarInt t = varint_zero, delta = varint_zero;
+
+	// x = x_half * 2^shift, only x_half's digits take part in the products.
+	vi_shr_assign_VarInt(&t, d, shift);
+	internal_reciprocal_VarInt(x, &t, half, 0);
+
+	// e = 2^(2 * bits) - d * x.
+	vi_mul_assign_VarInt(&t, d, x);
+	vi_shl_assign_VarInt(&t, &t, shift);
+	vi_sub_assign_VarInt(&e, &e, &t);
+
+	// x += x * e / 2^(2 * bits), e's low bits are below the precision.
+	vi_shr_assign_VarInt(&e, &e, (int) bits - 8);
+	vi_mul_assign_VarInt(&delta, x, &e);
+	vi_shr_assign_VarInt(&delta, &delta, (int) bits + 8 - shift);
+	vi_shl_assign_VarInt(x, x, shift);
+	vi_add_assign_VarInt(x, x, &delta);
+
+	if(exact)
+	{
+		// e = 2^(2 * bits) - d * x, then move x until 0 <= e < d.
+		vi_shl_assign_VarInt(&e, &varint_one, (int) (2 * bits));
+		vi_mul_assign_VarInt(&t, d, x);
+		vi_sub_assign_VarInt(&e, &e, &t);
+
+		while(e.size && e.sign == kNeg)
+		{
+			vi_dec_assign_VarInt(x, x);
+			vi_add_assign_VarInt(&e, &e, d);
+		}
+		while(vi_compare_VarInt(&e, d) >= 0)
+		{
+			vi_inc_assign_VarInt(x, x);
+			vi_sub_assign_VarInt(&e, &e, d);
 		}
 	}
 
-	vi_destroy_VarInt(&decrease);
-	vi_destroy_VarInt(&count_down);
-	vi_destroy_VarInt(&quo_inc);
+	vi_destroy_VarInt(&e);
+	vi_destroy_VarInt(&t);
+	vi_destroy_VarInt(&delta);
+}
+
+// dest = floor(2^bits / |src|), or a few units less if not exact.
+static void internal_scaled_reciprocal_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	size_t bits,
+	int exact)
+{
+	// normalise src to l bits, with l large enough to hold the result.
+	size_t const m = internal_bit_length_VarInt(src);
+	size_t const l = bits > 2 * m ? bits - m : m;
+
+	VarInt d = varint_zero, x = varint_zero;
+	vi_shl_assign_VarInt(&d, src, (int) (l - m));
+	d.sign = kPos;
+
+	// 2^bits / src = 2^(bits + l - m) / d = (2^(2 * l) / d) / 2^(l + m - bits).
+	internal_reciprocal_VarInt(&x, &d, l, exact);
+	vi_shr_assign_VarInt(dest, &x, (int) (l + m - bits));
+
+	vi_destroy_VarInt(&d);
+	vi_destroy_VarInt(&x);
+}
+
+void vi_reciprocal_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	size_t bits)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+	assert(src->size != 0 && "cannot divide by zero");
+
+	sign_t const sign = src->sign;
+	internal_scaled_reciprocal_VarInt(dest, src, bits, 1);
+	dest->sign = dest->size ? sign : kPos;
+}
+
+/* quo = |srca| / |srcb|, rem = |srca| % |srcb| via a reciprocal of srcb.
+Only the top bits of both operands are needed to estimate the quotient,
+which is then corrected with the exact remainder. */
+static void internal_div_mod_newton_VarInt(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	VarInt const a = digits_view(srca->digits, srca->size);
+	VarInt const b = digits_view(srcb->digits, srcb->size);
+
+	size_t const a_bits = internal_bit_length_VarInt(&a);
+	size_t const b_bits = internal_bit_length_VarInt(&b);
+	size_t const quo_bits = a_bits - b_bits + 1;
+	size_t const b_cut = b_bits > quo_bits + DIGIT_BITS
+		? b_bits - quo_bits - DIGIT_BITS
+		: 0;
+	size_t const a_cut = a_bits > quo_bits + 2 * DIGIT_BITS
+		? a_bits - quo_bits - 2 * DIGIT_BITS
+		: 0;
+
+	VarInt q = varint_zero, r = varint_zero, t = varint_zero;
+
+	// q = (a / 2^a_cut) * floor(2^k / (b / 2^b_cut)) / 2^(k + b_cut - a_cut),
+	// with k = a_bits - b_cut.
+	vi_shr_assign_VarInt(&t, &b, (int) b_cut);
+	internal_scaled_reciprocal_VarInt(&r, &t, a_bits - b_cut, 0);
+	vi_shr_assign_VarInt(&t, &a, (int) a_cut);
+	vi_mul_assign_VarInt(&q, &t, &r);
+	vi_shr_assign_VarInt(&q, &q, (int) (a_bits - a_cut));
+
+	// r = a - q * b, the estimate is off by a few units at most.
+	vi_mul_assign_VarInt(&t, &q, &b);
+	vi_sub_assign_VarInt(&r, &a, &t);
+
+	while(r.size && r.sign == kNeg)
+	{
+		vi_dec_assign_VarInt(&q, &q);
+		vi_add_assign_VarInt(&r, &r, &b);
+	}
+	while(vi_compare_VarInt(&r, &b) >= 0)
+	{
+		vi_inc_assign_VarInt(&q, &q);
+		vi_sub_assign_VarInt(&r, &r, &b);
+	}
+
+	if(quo)
+		vi_copy_assign_VarInt(quo, &q);
+	if(rem)
+		vi_copy_assign_VarInt(rem, &r);
+
+	vi_destroy_VarInt(&q);
+	vi_destroy_VarInt(&r);
+	vi_destroy_VarInt(&t);
+}
+
+void vi_div_mod_assign_VarInt(
+	VarInt * quo,
+	VarInt * rem,
+	VarInt const * srca,
+	VarInt const * srcb)
+{
+	assert(srca != NULL);
+	assert(srcb != NULL);
+	assert(srcb->size != 0 && "cannot divide by zero");
+	if(quo || rem)
+		assert(quo != rem);
+
+	sign_t const quo_sign = (srca->sign == srcb->sign)
+		? kPos
+		: kNeg;
+	sign_t const rem_sign = srca->sign;
+
+	int const newton = srcb->size >= VI_NEWTON_THRESHOLD
+		&& srca->size >= srcb->size + VI_NEWTON_THRESHOLD;
+	int const bz = srcb->size >= VI_BURNIKEL_ZIEGLER_THRESHOLD
+		&& srca->size >= srcb->size + VI_BURNIKEL_ZIEGLER_OFFSET;
+
+	if(newton || bz)
+	{
+		// the results are assembled in temporaries, as the outputs may be sources.
+		VarInt q = varint_zero, r = varint_zero;
+		if(newton)
+			internal_div_mod_newton_VarInt(
+				quo ? &q : NULL,
+				rem ? &r : NULL,
+				srca,
+				srcb);
+		else
+			internal_div_mod_bz_VarInt(
+				quo ? &q : NULL,
+				rem ? &r : NULL,
+				srca,
+				srcb);
+
+		if(quo)
+		{
+			vi_destroy_VarInt(quo);
+			*quo = q;
+		}
+		if(rem)
+		{
+			vi_destroy_VarInt(rem);
+			*rem = r;
+		}
+	} else
+	{
+		internal_div_mod_VarInt(quo, rem, srca, srcb);
+	}
 
-	rem->sign = srca->sign;
-	quo->sign = (srca->sign != srcb->sign);
+	if(quo)
+		quo->sign = quo->size ? quo_sign : kPos;
+	if(rem)
+		rem->sign = rem->size ? rem_sign : kPos;
 }
 
 void vi_dec_assign_VarInt(
@@ -830,6 +2248,108 @@ int vi_abs_compare_VarInt(
 	return 0;
 }
 
+// dest = srca * srcb in whatever arithmetic an exponentiation works in.
+typedef void (*pow_mul_t)(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	void * arg);
+
+// returns bit i of the magnitude of this.
+static int internal_bit_VarInt(
+	VarInt const * this,
+	size_t i)
+{
+	return (this->digits[i / DIGIT_BITS] >> (i % DIGIT_BITS)) & 1;
+}
+
+/* dest = base^exp for exp > 0, by left to right sliding windows over a table
+of the odd powers of base. mul must allow dest to alias its sources. */
+static void internal_pow_window_VarInt(
+	VarInt * dest,
+	VarInt const * base,
+	VarInt const * exp,
+	pow_mul_t mul,
+	void * arg)
+{
+	assert(exp->size && exp->sign == kPos);
+
+	size_t const bits = internal_bit_length_VarInt(exp);
+
+	// the window grows with the exponent, until the table costs more than it saves.
+	static size_t const window_limits[] = { 7, 25, 81, 241, 673, 1793, 4609 };
+	size_t k = 1;
+	while(k <= sizeof(window_limits) / sizeof(*window_limits)
+		&& bits > window_limits[k - 1])
+		++k;
+
+	// table[i] = base^(2i + 1).
+	size_t const count = (size_t)1 << (k - 1);
+	VarInt * table = NULL;
+	vi_malloc(
+		(void**)&table,
+		sizeof(VarInt),
+		count);
+	for(size_t i = 0; i < count; i++)
+		table[i] = varint_zero;
+
+	vi_copy_assign_VarInt(&table[0], base);
+	if(count > 1)
+	{
+		VarInt square = varint_zero;
+		mul(&square, base, base, arg);
+		for(size_t i = 1; i < count; i++)
+			mul(&table[i], &table[i - 1], &square, arg);
+		vi_destroy_VarInt(&square);
+	}
+
+	// the first window is copied instead of multiplied into 1.
+	int empty = 1;
+	for(size_t i = bits; i--;)
+	{
+		if(!internal_bit_VarInt(exp, i))
+		{
+			mul(dest, dest, dest, arg);
+			continue;
+		}
+
+		// the longest window of at most k bits from bit i that ends in a set bit.
+		size_t j = i + 1 > k ? i + 1 - k : 0;
+		while(!internal_bit_VarInt(exp, j))
+			++j;
+
+		size_t value = 0;
+		for(size_t b = i + 1; b-- > j;)
+			value = (value << 1) | internal_bit_VarInt(exp, b);
+
+		if(empty)
+		{
+			vi_copy_assign_VarInt(dest, &table[value >> 1]);
+			empty = 0;
+		} else
+		{
+			for(size_t b = j; b <= i; b++)
+				mul(dest, dest, dest, arg);
+			mul(dest, dest, &table[value >> 1], arg);
+		}
+		i = j;
+	}
+
+	for(size_t i = 0; i < count; i++)
+		vi_destroy_VarInt(&table[i]);
+	vi_free((void**)&table);
+}
+
+static void pow_mul(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	void * arg)
+{
+	(void) arg;
+	vi_mul_assign_VarInt(dest, srca, srcb);
+}
+
 void vi_pow_assign_VarInt(
 	VarInt * dest,
 	VarInt const * base,
@@ -850,55 +2370,292 @@ void vi_pow_assign_VarInt(
 	}
 
 
-	if(!exp->size)
+	if(!exp->size)
+	{
+		vi_copy_assign_VarInt(dest, &varint_one);
+		return;
+	}
+
+	if(!base->size)
+	{
+		dest->size = 0;
+		return;
+	}
+
+	if(vi_compare_VarInt(base, &varint_one) == 0)
+	{
+		vi_copy_assign_VarInt(dest, &varint_one);
+		return;
+	}
+
+	if(exp->sign == kNeg)
+	{
+		dest->size = 0;
+		return;
+	}
+
+	internal_pow_window_VarInt(dest, base, exp, pow_mul, NULL);
+}
+
+// drops all but the lowest count digits of this.
+static void internal_truncate_VarInt(
+	VarInt * this,
+	size_t count)
+{
+	if(this->size > count)
+		this->size = digits_normalise(this->digits, count);
+	if(!this->size)
+		this->sign = kPos;
+}
+
+// this = this / R mod n, for 0 <= this < n * R.
+static void internal_redc_VarInt(
+	VarInt * this,
+	Montgomery const * ctx)
+{
+	size_t const n = ctx->mod.size;
+	digit_t const * const mod = ctx->mod.digits;
+
+	assert(this->sign == kPos);
+	assert(this->size <= 2 * n);
+
+	if(n >= VI_REDC_THRESHOLD)
+	{
+		// m = (this mod R) * -n^-1 mod R, then this + m * n is divisible by R.
+		VarInt const low = digits_view(
+			this->digits,
+			digits_normalise(this->digits, this->size < n ? this->size : n));
+		VarInt m = varint_zero;
+		vi_mul_assign_VarInt(&m, &low, &ctx->inv);
+		internal_truncate_VarInt(&m, n);
+		vi_mul_assign_VarInt(&m, &m, &ctx->mod);
+		vi_add_assign_VarInt(this, this, &m);
+		vi_shr_assign_VarInt(this, this, (int) (n * DIGIT_BITS));
+		vi_destroy_VarInt(&m);
+	} else
+	{
+		if(this->capacity < 2 * n + 1)
+			vi_realloc_digit(
+				&this->digits,
+				this->capacity = 2 * n + 1);
+		digit_t * const t = this->digits;
+		for(size_t i = this->size; i < 2 * n + 1; i++)
+			t[i] = 0;
+
+		// clear one digit at a time by adding a multiple of n.
+		for(size_t i = 0; i < n; i++)
+		{
+			digit_t const m = t[i] * ctx->inv_digit;
+			digit_t carry = digits_addmul_1(t + i, mod, n, m);
+			for(size_t j = i + n; carry; j++)
+			{
+				assert(j < 2 * n + 1);
+				digit_add(t[j], carry, 0, &t[j], &carry);
+			}
+		}
+
+		memmove(t, t + n, (n + 1) * sizeof(digit_t));
+		this->size = digits_normalise(t, n + 1);
+	}
+
+	// the result is below 2n.
+	if(vi_compare_VarInt(this, &ctx->mod) >= 0)
+		vi_sub_assign_VarInt(this, this, &ctx->mod);
+}
+
+/* dest = srca * srcb / R mod n. The product is formed in scratch, which
+keeps its capacity across calls, so exponentiation loops do not allocate. */
+static void internal_montgomery_mul_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	VarInt * scratch,
+	Montgomery const * ctx)
+{
+	assert(scratch != dest && scratch != srca && scratch != srcb);
+
+	if(scratch->capacity < 2 * ctx->mod.size + 1)
+		vi_realloc_digit(
+			&scratch->digits,
+			scratch->capacity = 2 * ctx->mod.size + 1);
+
+	vi_mul_assign_VarInt(scratch, srca, srcb);
+	internal_redc_VarInt(scratch, ctx);
+	vi_copy_assign_VarInt(dest, scratch);
+}
+
+// (re)computes the context for mod, reusing the buffers this already holds.
+static void internal_assign_Montgomery(
+	Montgomery * this,
+	VarInt const * mod)
+{
+	size_t const n = mod->size;
+
+	vi_copy_assign_VarInt(&this->mod, mod);
+	this->mod.sign = kPos;
+
+	// inverse of the lowest digit by Newton's method, each step doubles the correct bits.
+	digit_t const n0 = mod->digits[0];
+	digit_t inv = n0;
+	for(size_t bits = 3; bits < DIGIT_BITS; bits *= 2)
+		inv *= 2 - n0 * inv;
+	this->inv_digit = (digit_t) (0 - inv);
+
+	// -n^-1 mod R by Hensel lifting: if n * x = -1 mod 2^k, x * (n * x + 2) is correct mod 2^2k.
+	this->inv.size = 0;
+	this->inv.sign = kPos;
+	if(n >= VI_REDC_THRESHOLD)
+	{
+		VarInt t = varint_zero;
+		vi_copy_assign_VarInt(&this->inv, &varint_one);
+		this->inv.digits[0] = this->inv_digit;
+		for(size_t k = 2; k < 2 * n; k *= 2)
+		{
+			size_t const digits = k < n ? k : n;
+			vi_mul_assign_VarInt(&t, &this->mod, &this->inv);
+			internal_truncate_VarInt(&t, digits);
+			vi_add_assign_VarInt(&t, &t, &varint_two);
+			vi_mul_assign_VarInt(&this->inv, &this->inv, &t);
+			internal_truncate_VarInt(&this->inv, digits);
+		}
+		vi_destroy_VarInt(&t);
+	}
+
+	// R^2 mod n and R mod n.
+	vi_shl_assign_VarInt(&this->r2, &varint_one, (int) (2 * n * DIGIT_BITS));
+	vi_div_mod_assign_VarInt(NULL, &this->r2, &this->r2, &this->mod);
+	vi_copy_assign_VarInt(&this->r, &this->r2);
+	internal_redc_VarInt(&this->r, this);
+}
+
+void vi_create_Montgomery(
+	Montgomery * this,
+	VarInt const * mod)
+{
+	assert(this != NULL);
+	assert(mod != NULL);
+	assert(!vi_is_even_VarInt(mod) && "the Montgomery modulus must be odd");
+
+	vi_create_VarInt(&this->mod);
+	vi_create_VarInt(&this->r);
+	vi_create_VarInt(&this->r2);
+	vi_create_VarInt(&this->inv);
+	internal_assign_Montgomery(this, mod);
+}
+
+void vi_destroy_Montgomery(
+	Montgomery * this)
+{
+	assert(this != NULL);
+
+	vi_destroy_VarInt(&this->mod);
+	vi_destroy_VarInt(&this->r);
+	vi_destroy_VarInt(&this->r2);
+	vi_destroy_VarInt(&this->inv);
+}
+
+void vi_to_montgomery_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+	assert(ctx != NULL);
+
+	// the magnitude below shares src's digits.
+	if(dest == src)
 	{
-		vi_copy_assign_VarInt(dest, &varint_one);
+		ScratchMark const mark = scratch_mark();
+		VarInt const copy = scratch_copy_VarInt(src);
+		vi_to_montgomery_VarInt(dest, &copy, ctx);
+		scratch_pop(mark);
 		return;
 	}
 
-	if(!base->size)
+	VarInt const magnitude = digits_view(src->digits, src->size);
+	if(vi_compare_VarInt(&magnitude, &ctx->mod) >= 0)
 	{
-		dest->size = 0;
-		return;
-	}
-
-	if(vi_compare_VarInt(base, &varint_one) == 0)
+		vi_div_mod_assign_VarInt(NULL, dest, &magnitude, &ctx->mod);
+		vi_montgomery_mul_assign_VarInt(dest, dest, &ctx->r2, ctx);
+	} else
 	{
-		vi_copy_assign_VarInt(dest, &varint_one);
-		return;
+		vi_montgomery_mul_assign_VarInt(dest, &magnitude, &ctx->r2, ctx);
 	}
+}
 
-	if(exp->sign == kNeg)
-	{
-		dest->size = 0;
-		return;
-	}
+void vi_from_montgomery_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+	assert(ctx != NULL);
+	assert(src->sign == kPos);
 
-	vi_copy_assign_VarInt(dest, &varint_one);
-	VarInt mul;
-	vi_copy_create_VarInt(&mul, base);
+	if(dest != src)
+		vi_copy_assign_VarInt(dest, src);
+	internal_redc_VarInt(dest, ctx);
+}
+
+void vi_montgomery_mul_assign_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	Montgomery const * ctx)
+{
+	assert(dest != NULL);
+	assert(srca != NULL);
+	assert(srcb != NULL);
+	assert(ctx != NULL);
+	assert(srca->sign == kPos && srcb->sign == kPos);
 
+	VarInt scratch = varint_zero;
+	internal_montgomery_mul_VarInt(dest, srca, srcb, &scratch, ctx);
+	vi_destroy_VarInt(&scratch);
+}
 
-	for(size_t d = 0; d < exp->size; d++)
-	{
-		for(size_t b = 0; b < DIGIT_BITS; b++)
-		{
-			if(exp->digits[d] & (digit_t)((digit_t)1 << b))
-			{
-				vi_mul_assign_VarInt(dest, dest, &mul);
-				if(d == exp->size - 1 && b != DIGIT_BITS)
-				{
-					digit_t mask = (1 << (b+1)) - 1;
-					if(!(exp->digits[d] & ~mask))
-						break;
-				}
-			}
+void vi_montgomery_sqr_assign_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx)
+{
+	assert(dest != NULL);
+	assert(src != NULL);
+	assert(ctx != NULL);
+	assert(src->sign == kPos);
 
-			vi_mul_assign_VarInt(&mul, &mul, &mul);
-		}
-	}
+	VarInt scratch = varint_zero;
+	internal_montgomery_mul_VarInt(dest, src, src, &scratch, ctx);
+	vi_destroy_VarInt(&scratch);
+}
 
-	vi_destroy_VarInt(&mul);
+// the Montgomery context and product buffer of an exponentiation.
+typedef struct
+{
+	Montgomery const * ctx;
+	VarInt * scratch;
+} MontgomeryPow;
+
+static void pow_mul_montgomery(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	void * arg)
+{
+	MontgomeryPow const * pow = arg;
+	internal_montgomery_mul_VarInt(dest, srca, srcb, pow->scratch, pow->ctx);
+}
+
+static void pow_mul_mod(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	void * arg)
+{
+	vi_mul_assign_VarInt(dest, srca, srcb);
+	vi_div_mod_assign_VarInt(NULL, dest, dest, (VarInt const *) arg);
 }
 
 void vi_pow_mod_assign_VarInt(
@@ -947,30 +2704,32 @@ void vi_pow_mod_assign_VarInt(
 		return;
 	}
 
-	vi_copy_assign_VarInt(dest, &varint_one);
-	VarInt mul;
-	vi_div_mod_create_VarInt(NULL, &mul, base, mod);
-
-	for(size_t d = 0; d < exp->size; d++)
+	// odd moduli multiply in Montgomery form, without any division in the loop.
+	if(!vi_is_even_VarInt(mod))
 	{
-		for(size_t b = 0; b < DIGIT_BITS; b++)
-		{
-			if(exp->digits[d] & (digit_t)((digit_t)1 << b))
-			{
-				vi_mul_assign_VarInt(dest, dest, &mul);
-				vi_div_mod_assign_VarInt(NULL, dest, dest, mod);
-				if(d == exp->size - 1 && b != DIGIT_BITS)
-				{
-					digit_t mask = (1 << (b+1)) - 1;
-					if(!(exp->digits[d] & ~mask))
-						break;
-				}
-			}
+		Montgomery ctx;
+		vi_create_Montgomery(&ctx, mod);
 
-			vi_mul_assign_VarInt(&mul, &mul, &mul);
-			vi_div_mod_assign_VarInt(NULL, &mul, &mul, mod);
-		}
+		VarInt mul = varint_zero, scratch = varint_zero;
+		MontgomeryPow const pow = { &ctx, &scratch };
+		vi_to_montgomery_VarInt(&mul, base, &ctx);
+
+		internal_pow_window_VarInt(dest, &mul, exp, pow_mul_montgomery, (void *) &pow);
+
+		vi_from_montgomery_VarInt(dest, dest, &ctx);
+		// odd powers of negative bases stay negative, like the remainder does.
+		if(base->sign == kNeg && (exp->digits[0] & 1) && dest->size)
+			dest->sign = kNeg;
+
+		vi_destroy_VarInt(&mul);
+		vi_destroy_VarInt(&scratch);
+		vi_destroy_Montgomery(&ctx);
+		return;
 	}
+
+	VarInt mul;
+	vi_div_mod_create_VarInt(NULL, &mul, base, mod);
+	internal_pow_window_VarInt(dest, &mul, exp, pow_mul_mod, (void *) mod);
 	vi_destroy_VarInt(&mul);
 }
 
@@ -1017,19 +2776,19 @@ static sign_t internal_sub_assign_VarInt(
 
 	if(dest == srca)
 	{
-		VarInt copy_srca;
-		vi_copy_create_VarInt(&copy_srca, srca);
+		ScratchMark const mark = scratch_mark();
+		VarInt const copy_srca = scratch_copy_VarInt(srca);
 		sign_t result = internal_sub_assign_VarInt(dest, &copy_srca, srcb);
-		vi_destroy_VarInt(&copy_srca);
+		scratch_pop(mark);
 		return result;
 	}
 
 	if(dest == srcb)
 	{
-		VarInt copy_srcb;
-		vi_copy_create_VarInt(&copy_srcb, srcb);
+		ScratchMark const mark = scratch_mark();
+		VarInt const copy_srcb = scratch_copy_VarInt(srcb);
 		sign_t result = internal_sub_assign_VarInt(dest, srca, &copy_srcb);
-		vi_destroy_VarInt(&copy_srcb);
+		scratch_pop(mark);
 		return result;
 	}
 
@@ -1049,8 +2808,8 @@ static sign_t internal_sub_assign_VarInt(
 	{
 		vi_copy_assign_VarInt(dest, longer);
 		return srca == shorter
-			? !longer->sign
-			: shorter->sign;
+			? !srca->sign
+			: srca->sign;
 	}
 
 	digit_t carry;
@@ -1063,33 +2822,29 @@ static sign_t internal_sub_assign_VarInt(
 	}
 	dest->size = 0;
 
-	carry = 0;
-	for(size_t i = 0; i < shorter->size; i++)
-	{
-		digit_sub(
-			longer->digits[i],
-			shorter->digits[i],
-			carry,
-			&dest->digits[i],
-			&carry);
-		if(dest->digits[i])
-			dest->size = i+1;
-	}
-	for(size_t i = shorter->size; i < longer->size; i++)
-	{
-		digit_sub(
-			longer->digits[i],
-			0,
-			carry,
-			&dest->digits[i],
-			&carry);
-		if(dest->digits[i])
-			dest->size = i+1;
-	}
+	carry = digits_sub(
+		dest->digits,
+		longer->digits,
+		longer->size,
+		shorter->digits,
+		shorter->size);
+	dest->size = digits_normalise(dest->digits, longer->size);
 	if(carry)
 	{
-		for(size_t i = 0; i < dest->size; i++)
-			dest->digits[i] = DIGIT_MAX - dest->digits[i] + 1;
+		// the result wrapped around, negate the two's complement.
+		digit_t neg_carry = 1;
+		dest->size = 0;
+		for(size_t i = 0; i < longer->size; i++)
+		{
+			digit_add(
+				~dest->digits[i],
+				0,
+				neg_carry,
+				&dest->digits[i],
+				&neg_carry);
+			if(dest->digits[i])
+				dest->size = i+1;
+		}
 	}
 
 	if(shorter == srca)
@@ -1205,9 +2960,9 @@ char * vi_to_string_VarInt(
 
 	if(!written)
 	{
-		*str='0';
+		*str++ = '0';
 	}
-	*++str = '\0';
+	*str = '\0';
 
 	return ret;
 }
@@ -1244,116 +2999,651 @@ void vi_create_from_hex_VarInt(
 		s = *str == '-' ? kNeg : kPos;
 		++str;
 	}
-	this->capacity = (length >> 1) + (length & 1);
+	if(!length)
+		return;
+
+	// every digit holds two nibbles per byte.
+	this->capacity = length / (sizeof(digit_t) * 2)
+		+ !!(length % (sizeof(digit_t) * 2));
 	vi_calloc_digit(
 		&this->digits,
 		this->capacity);
 
-	digit_t d = 0;
+	digit_t d = 0;
+
+	size_t nibble = 0;
+	size_t n = 0;
+
+	for(size_t i = length; i--;)
+	{
+		d |= (digit_t)hex_digit(str[i]) << (nibble++<<2);
+		if(nibble == sizeof(digit_t) * 2)
+		{
+			this->digits[n++] = d;
+			if(d)
+				this->size = n;
+			nibble = 0;
+			d = 0;
+		}
+	}
+
+	if(nibble)
+	{
+		this->digits[n++] = d;
+		if(d)
+			this->size = n;
+	}
+
+	this->sign = s;
+}
+
+// the number of random Miller-Rabin bases for numbers past the deterministic base sets.
+#ifndef VI_MILLER_RABIN_ROUNDS
+#define VI_MILLER_RABIN_ROUNDS 24
+#endif
+
+/* the first 12 primes decide every number below 2^64 as Miller-Rabin bases,
+all 13 every number below 3.3 * 10^24 (Sorenson and Webster). */
+static digit_t const miller_rabin_bases[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41
+};
+
+/* returns 1 if this is one of the Miller-Rabin bases, 0 if it is below 2 or
+has one of them as a factor, and -1 if the small primes cannot decide. */
+static int internal_small_prime_test_VarInt(
+	VarInt const * this)
+{
+	if(vi_compare_VarInt(this, &varint_one) <= 0)
+		return 0;
+
+	size_t const count = sizeof(miller_rabin_bases) / sizeof(*miller_rabin_bases);
+	for(size_t i = 0; i < count; i++)
+	{
+		if(this->size == 1 && this->digits[0] == miller_rabin_bases[i])
+			return 1;
+		if(!digits_div_1(NULL, this->digits, this->size, miller_rabin_bases[i]))
+			return 0;
+	}
+	return -1;
+}
+
+/* one Miller-Rabin round for odd n = d * 2^s + 1, with base in Montgomery form.
+x and scratch are work space. returns 0 if base proves n composite. */
+static int internal_miller_rabin_VarInt(
+	VarInt const * base,
+	VarInt const * d,
+	size_t s,
+	VarInt const * minus_one,
+	Montgomery const * ctx,
+	VarInt * x,
+	VarInt * scratch)
+{
+	MontgomeryPow const pow = { ctx, scratch };
+
+	// x = base^d, n is a probable prime if that is +-1.
+	internal_pow_window_VarInt(x, base, d, pow_mul_montgomery, (void *) &pow);
+	if(!vi_compare_VarInt(x, &ctx->r) || !vi_compare_VarInt(x, minus_one))
+		return 1;
+
+	// otherwise, squaring must reach -1 before it reaches 1.
+	for(size_t i = 1; i < s; i++)
+	{
+		internal_montgomery_mul_VarInt(x, x, x, scratch, ctx);
+		if(!vi_compare_VarInt(x, minus_one))
+			return 1;
+		if(!vi_compare_VarInt(x, &ctx->r))
+			return 0;
+	}
+
+	return 0;
+}
+
+// returns *shared, which other threads may lower concurrently.
+static size_t internal_atomic_read(
+	size_t const * shared)
+{
+	size_t value;
+	#pragma omp atomic read
+	value = *shared;
+	return value;
+}
+
+// the work space of Miller-Rabin tests, reusable across tests of different numbers.
+typedef struct
+{
+	Montgomery ctx;
+	VarInt n_minus_one;
+	VarInt d;
+	VarInt minus_one;
+	VarInt range;
+	VarInt base;
+	VarInt x;
+	VarInt scratch;
+} MillerRabinScratch;
+
+static void internal_create_MillerRabinScratch(
+	MillerRabinScratch * this)
+{
+	vi_create_VarInt(&this->ctx.mod);
+	vi_create_VarInt(&this->ctx.r);
+	vi_create_VarInt(&this->ctx.r2);
+	vi_create_VarInt(&this->ctx.inv);
+	vi_create_VarInt(&this->n_minus_one);
+	vi_create_VarInt(&this->d);
+	vi_create_VarInt(&this->minus_one);
+	vi_create_VarInt(&this->range);
+	vi_create_VarInt(&this->base);
+	vi_create_VarInt(&this->x);
+	vi_create_VarInt(&this->scratch);
+}
+
+static void internal_destroy_MillerRabinScratch(
+	MillerRabinScratch * this)
+{
+	vi_destroy_Montgomery(&this->ctx);
+	vi_destroy_VarInt(&this->n_minus_one);
+	vi_destroy_VarInt(&this->d);
+	vi_destroy_VarInt(&this->minus_one);
+	vi_destroy_VarInt(&this->range);
+	vi_destroy_VarInt(&this->base);
+	vi_destroy_VarInt(&this->x);
+	vi_destroy_VarInt(&this->scratch);
+}
+
+/* Miller-Rabin as in vi_is_prime_miller_rabin_VarInt, in the given work space.
+If stop is not NULL, the test gives up between rounds once *stop falls below
+index, as the caller no longer needs the answer then. */
+static int internal_is_prime_miller_rabin_VarInt(
+	VarInt const * this,
+	size_t rounds,
+	size_t const * stop,
+	size_t index,
+	MillerRabinScratch * work)
+{
+	int const small = internal_small_prime_test_VarInt(this);
+	if(small >= 0)
+		return small;
+
+	size_t const bits = internal_bit_length_VarInt(this);
+
+	// n - 1 = d * 2^s.
+	vi_sub_assign_VarInt(&work->n_minus_one, this, &varint_one);
+	size_t s = 0;
+	while(!internal_bit_VarInt(&work->n_minus_one, s))
+		++s;
+	vi_shr_assign_VarInt(&work->d, &work->n_minus_one, (int) s);
+
+	Montgomery const * const ctx = &work->ctx;
+	internal_assign_Montgomery(&work->ctx, this);
+	vi_to_montgomery_VarInt(&work->minus_one, &work->n_minus_one, ctx);
+
+	int maybe_prime = 1;
+	if(bits <= 81)
+	{
+		size_t const count = bits <= 64 ? 12 : 13;
+		for(size_t i = 0; maybe_prime && i < count; i++)
+		{
+			if(stop && internal_atomic_read(stop) < index)
+			{
+				maybe_prime = 0;
+				break;
+			}
+			VarInt const small = digits_view(&miller_rabin_bases[i], 1);
+			vi_to_montgomery_VarInt(&work->base, &small, ctx);
+			maybe_prime = internal_miller_rabin_VarInt(&work->base, &work->d, s, &work->minus_one, ctx, &work->x, &work->scratch);
+		}
+	} else
+	{
+		// random bases in [2, n - 2].
+		vi_sub_assign_VarInt(&work->range, &work->n_minus_one, &varint_two);
+		for(size_t i = 0; maybe_prime && i < rounds; i++)
+		{
+			if(stop && internal_atomic_read(stop) < index)
+			{
+				maybe_prime = 0;
+				break;
+			}
+			vi_assign_random_VarInt(&work->base, this->size * sizeof(digit_t));
+			vi_div_mod_assign_VarInt(NULL, &work->base, &work->base, &work->range);
+			vi_add_assign_VarInt(&work->base, &work->base, &varint_two);
+			vi_to_montgomery_VarInt(&work->base, &work->base, ctx);
+			maybe_prime = internal_miller_rabin_VarInt(&work->base, &work->d, s, &work->minus_one, ctx, &work->x, &work->scratch);
+		}
+	}
+
+	return maybe_prime;
+}
+
+int vi_is_prime_miller_rabin_VarInt(
+	VarInt const * this,
+	size_t rounds)
+{
+	assert(this != NULL);
+	assert(this->sign == kPos);
+
+	// no rounds would pass every large odd number without small factors.
+	if(!rounds)
+		rounds = VI_MILLER_RABIN_ROUNDS;
+
+	MillerRabinScratch work;
+	internal_create_MillerRabinScratch(&work);
+	int const prime = internal_is_prime_miller_rabin_VarInt(this, rounds, NULL, 0, &work);
+	internal_destroy_MillerRabinScratch(&work);
+	return prime;
+}
+
+// returns the number of trailing zero bits of this, which must not be 0.
+static size_t internal_trailing_zeros_VarInt(
+	VarInt const * this)
+{
+	size_t i = 0;
+	while(!this->digits[i])
+		++i;
+	size_t bits = i * DIGIT_BITS;
+	for(digit_t digit = this->digits[i]; !(digit & 1); digit >>= 1)
+		++bits;
+	return bits;
+}
+
+void vi_gcd_assign_VarInt(
+	VarInt * dest,
+	VarInt const * a,
+	VarInt const * b)
+{
+	assert(dest != NULL);
+	assert(a != NULL);
+	assert(b != NULL);
+
+	if(!a->size || !b->size)
+	{
+		vi_copy_assign_VarInt(dest, a->size ? a : b);
+		dest->sign = kPos;
+		return;
+	}
+
+	VarInt u = varint_zero, v = varint_zero;
+	vi_copy_assign_VarInt(&u, a);
+	vi_copy_assign_VarInt(&v, b);
+	u.sign = v.sign = kPos;
+
+	// gcd(2^i u, 2^j v) = 2^min(i, j) gcd(u, v) for odd u and v.
+	size_t const zu = internal_trailing_zeros_VarInt(&u);
+	size_t const zv = internal_trailing_zeros_VarInt(&v);
+	vi_shr_assign_VarInt(&u, &u, (int) zu);
+	vi_shr_assign_VarInt(&v, &v, (int) zv);
+
+	/* binary gcd: with u <= v both odd, v - u is even and shares the gcd.
+	Where v is much longer than u, a division shortens it faster. */
+	for(;;)
+	{
+		int const order = vi_compare_VarInt(&u, &v);
+		if(!order)
+			break;
+		if(order > 0)
+		{
+			VarInt const t = u;
+			u = v;
+			v = t;
+		}
+
+		if(v.size > u.size + 1)
+			vi_div_mod_assign_VarInt(NULL, &v, &v, &u);
+		else
+			vi_sub_assign_VarInt(&v, &v, &u);
+		if(!v.size)
+			break;
+		vi_shr_assign_VarInt(&v, &v, (int) internal_trailing_zeros_VarInt(&v));
+	}
+
+	vi_shl_assign_VarInt(dest, &u, (int) (zu < zv ? zu : zv));
+
+	vi_destroy_VarInt(&u);
+	vi_destroy_VarInt(&v);
+}
+
+int vi_jacobi_VarInt(
+	VarInt const * a,
+	VarInt const * n)
+{
+	assert(a != NULL);
+	assert(n != NULL);
+	assert(n->sign == kPos && !vi_is_even_VarInt(n) && "the Jacobi symbol needs an odd positive n");
+
+	VarInt x = varint_zero, y = varint_zero;
+	vi_copy_assign_VarInt(&y, n);
+
+	// x = a mod n, in [0, n).
+	vi_div_mod_assign_VarInt(NULL, &x, a, n);
+	if(x.sign == kNeg)
+		vi_add_assign_VarInt(&x, &x, n);
+
+	int result = 1;
+	while(x.size)
+	{
+		// (2/y) = -1 for y = 3, 5 mod 8.
+		size_t twos = 0;
+		while(!internal_bit_VarInt(&x, twos))
+			++twos;
+		vi_shr_assign_VarInt(&x, &x, (int) twos);
+		digit_t const y8 = y.digits[0] & 7;
+		if((twos & 1) && (y8 == 3 || y8 == 5))
+			result = -result;
+
+		// quadratic reciprocity.
+		if((x.digits[0] & 3) == 3 && (y.digits[0] & 3) == 3)
+			result = -result;
+
+		VarInt const t = x;
+		x = y;
+		y = t;
+		vi_div_mod_assign_VarInt(NULL, &x, &x, &y);
+	}
+
+	if(vi_compare_VarInt(&y, &varint_one))
+		result = 0;
+
+	vi_destroy_VarInt(&x);
+	vi_destroy_VarInt(&y);
+	return result;
+}
+
+// dest = (srca + srcb) mod n, for sources in [0, n).
+static void internal_add_mod_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	VarInt const * mod)
+{
+	vi_add_assign_VarInt(dest, srca, srcb);
+	if(vi_compare_VarInt(dest, mod) >= 0)
+		vi_sub_assign_VarInt(dest, dest, mod);
+}
+
+// dest = (srca - srcb) mod n, for sources in [0, n).
+static void internal_sub_mod_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	VarInt const * mod)
+{
+	vi_sub_assign_VarInt(dest, srca, srcb);
+	if(dest->sign == kNeg)
+		vi_add_assign_VarInt(dest, dest, mod);
+}
+
+// dest = src / 2 mod n, for odd n and src in [0, n).
+static void internal_half_mod_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	VarInt const * mod)
+{
+	if(vi_is_even_VarInt(src))
+		vi_shr_assign_VarInt(dest, src, 1);
+	else
+	{
+		vi_add_assign_VarInt(dest, src, mod);
+		vi_shr_assign_VarInt(dest, dest, 1);
+	}
+}
+
+/* u = U_k, v = V_k and qk = Q^k of the Lucas sequences with parameters p and q,
+where d = p^2 - 4q. Everything is in Montgomery form, k > 0. Works through k
+from the top bit: doubling uses U_2k = U_k V_k and V_2k = V_k^2 - 2Q^k, a set
+bit then steps to U_k+1 = (P U_k + V_k) / 2 and V_k+1 = (D U_k + P V_k) / 2. */
+static void internal_lucas_VarInt(
+	VarInt * u,
+	VarInt * v,
+	VarInt * qk,
+	VarInt const * p,
+	VarInt const * q,
+	VarInt const * d,
+	VarInt const * k,
+	Montgomery const * ctx,
+	VarInt * scratch)
+{
+	assert(k->size && k->sign == kPos);
 
-	size_t nibble = 0;
-	size_t n = 0;
+	VarInt const * const mod = &ctx->mod;
+	int const p_is_one = !vi_compare_VarInt(p, &ctx->r);
+	VarInt t = varint_zero, w = varint_zero;
 
-	for(size_t i = length; i--;)
+	vi_copy_assign_VarInt(u, &ctx->r);
+	vi_copy_assign_VarInt(v, p);
+	vi_copy_assign_VarInt(qk, q);
+
+	for(size_t i = internal_bit_length_VarInt(k) - 1; i--;)
 	{
-		d |= (digit_t)hex_digit(str[i]) << (nibble++<<2);
-		if(nibble == sizeof(digit_t) * 2)
+		internal_montgomery_mul_VarInt(u, u, v, scratch, ctx);
+		internal_montgomery_mul_VarInt(v, v, v, scratch, ctx);
+		internal_add_mod_VarInt(&t, qk, qk, mod);
+		internal_sub_mod_VarInt(v, v, &t, mod);
+		internal_montgomery_mul_VarInt(qk, qk, qk, scratch, ctx);
+
+		if(internal_bit_VarInt(k, i))
 		{
-			this->digits[n++] = d;
-			if(d)
-				this->size = n;
-			nibble = 0;
-			d = 0;
+			// t = P U + V, w = D U + P V.
+			if(p_is_one)
+				internal_add_mod_VarInt(&t, u, v, mod);
+			else
+			{
+				internal_montgomery_mul_VarInt(&t, p, u, scratch, ctx);
+				internal_add_mod_VarInt(&t, &t, v, mod);
+			}
+			internal_montgomery_mul_VarInt(&w, d, u, scratch, ctx);
+			if(p_is_one)
+				internal_add_mod_VarInt(&w, &w, v, mod);
+			else
+			{
+				internal_montgomery_mul_VarInt(v, p, v, scratch, ctx);
+				internal_add_mod_VarInt(&w, &w, v, mod);
+			}
+
+			internal_half_mod_VarInt(u, &t, mod);
+			internal_half_mod_VarInt(v, &w, mod);
+			internal_montgomery_mul_VarInt(qk, qk, q, scratch, ctx);
 		}
 	}
 
-	if(nibble != sizeof(digit_t) * 2)
-	{
-		this->digits[n++] = d;
-		if(d)
-			this->size = n;
-	}
+	vi_destroy_VarInt(&t);
+	vi_destroy_VarInt(&w);
+}
 
-	this->sign = s;
+// x = src mod n in [0, n), in Montgomery form.
+static void internal_to_montgomery_signed_VarInt(
+	VarInt * x,
+	VarInt const * src,
+	Montgomery const * ctx)
+{
+	vi_to_montgomery_VarInt(x, src, ctx);
+	if(src->sign == kNeg && x->size)
+		vi_sub_assign_VarInt(x, &ctx->mod, x);
 }
 
-static int fermat(
-	VarInt const * base,
-	VarInt const * p)
+void vi_lucas_VarInt(
+	VarInt * u,
+	VarInt * v,
+	VarInt const * p,
+	VarInt const * q,
+	VarInt const * k,
+	VarInt const * mod)
 {
-	assert(base != NULL);
+	assert(u != NULL);
+	assert(v != NULL);
+	assert(u != v);
 	assert(p != NULL);
-	assert(vi_compare_VarInt(base, p) < 0);
+	assert(q != NULL);
+	assert(k != NULL);
+	assert(mod != NULL);
+	assert(k->sign == kPos);
+	assert(k != u && k != v);
 
+	Montgomery ctx;
+	vi_create_Montgomery(&ctx, mod);
 
-	VarInt temp = varint_zero;
-	vi_dec_assign_VarInt(
-		&temp,
-		p);
+	if(!k->size)
+	{
+		// U_0 = 0, V_0 = 2.
+		u->size = 0;
+		u->sign = kPos;
+		vi_div_mod_assign_VarInt(NULL, v, &varint_two, &ctx.mod);
+		vi_destroy_Montgomery(&ctx);
+		return;
+	}
 
-	vi_pow_mod_assign_VarInt(
-		&temp,
-		base,
-		&temp,
-		p);
+	VarInt pm = varint_zero, qm = varint_zero, dm = varint_zero, qk = varint_zero, scratch = varint_zero;
+
+	// d = p^2 - 4q.
+	VarInt d = varint_zero;
+	vi_sqr_assign_VarInt(&d, p);
+	vi_shl_assign_VarInt(&qk, q, 2);
+	vi_sub_assign_VarInt(&d, &d, &qk);
+
+	internal_to_montgomery_signed_VarInt(&pm, p, &ctx);
+	internal_to_montgomery_signed_VarInt(&qm, q, &ctx);
+	internal_to_montgomery_signed_VarInt(&dm, &d, &ctx);
+
+	internal_lucas_VarInt(u, v, &qk, &pm, &qm, &dm, k, &ctx, &scratch);
+	vi_from_montgomery_VarInt(u, u, &ctx);
+	vi_from_montgomery_VarInt(v, v, &ctx);
+
+	vi_destroy_VarInt(&pm);
+	vi_destroy_VarInt(&qm);
+	vi_destroy_VarInt(&dm);
+	vi_destroy_VarInt(&qk);
+	vi_destroy_VarInt(&d);
+	vi_destroy_VarInt(&scratch);
+	vi_destroy_Montgomery(&ctx);
+}
 
-	// the fermat test must result in a remainder of 1, or else the number is definitely not prime.
-	// fermat = base ^ (p-1) % p
-	int check = vi_compare_VarInt(&temp, &varint_one);
+// returns whether this is a perfect square, using Newton's method for the root.
+static int internal_is_square_VarInt(
+	VarInt const * this)
+{
+	if(!this->size)
+		return 1;
 
-	vi_destroy_VarInt(&temp);
+	VarInt x = varint_zero, y = varint_zero;
 
-	return (check == 0);
-}
+	// start above the root, then descend while the estimate shrinks.
+	vi_shl_assign_VarInt(&x, &varint_one, (int) ((internal_bit_length_VarInt(this) + 1) / 2));
+	for(;;)
+	{
+		vi_div_mod_assign_VarInt(&y, NULL, this, &x);
+		vi_add_assign_VarInt(&y, &y, &x);
+		vi_shr_assign_VarInt(&y, &y, 1);
+		if(vi_compare_VarInt(&y, &x) >= 0)
+			break;
+		vi_copy_assign_VarInt(&x, &y);
+	}
 
+	vi_sqr_assign_VarInt(&y, &x);
+	int const square = !vi_compare_VarInt(&y, this);
 
-int vi_is_prime_quick_VarInt(
+	vi_destroy_VarInt(&x);
+	vi_destroy_VarInt(&y);
+	return square;
+}
+
+int vi_is_prime_bpsw_VarInt(
 	VarInt const * this)
 {
 	assert(this != NULL);
 	assert(this->sign == kPos);
 
-	int maybe_prime = 1;
-	VarInt n;
-
-
-	//#pragma omp critical(loop_prime)
-	#pragma omp parallel
-	#pragma omp single nowait
-	for(vi_sub_create_VarInt(&n, this, &varint_one);
-		maybe_prime && vi_compare_VarInt(&n, &varint_one) > 0;
-		vi_shr_assign_VarInt(
-			&n,
-			&n,
-			1))
+	int const small = internal_small_prime_test_VarInt(this);
+	if(small >= 0)
+		return small;
+
+	Montgomery ctx;
+	vi_create_Montgomery(&ctx, this);
+	VarInt n_minus_one = varint_zero, d = varint_zero, minus_one = varint_zero;
+	VarInt two = varint_zero, x = varint_zero, scratch = varint_zero;
+
+	// strong probable prime test to base 2, with n - 1 = d * 2^s.
+	vi_sub_assign_VarInt(&n_minus_one, this, &varint_one);
+	size_t s = 0;
+	while(!internal_bit_VarInt(&n_minus_one, s))
+		++s;
+	vi_shr_assign_VarInt(&d, &n_minus_one, (int) s);
+	vi_to_montgomery_VarInt(&minus_one, &n_minus_one, &ctx);
+	vi_to_montgomery_VarInt(&two, &varint_two, &ctx);
+	int maybe_prime = internal_miller_rabin_VarInt(&two, &d, s, &minus_one, &ctx, &x, &scratch);
+
+	// the Lucas test needs a D with (D/n) = -1, which squares do not have.
+	if(maybe_prime && internal_is_square_VarInt(this))
+		maybe_prime = 0;
+
+	if(maybe_prime)
 	{
-#ifdef _OPENMP
-		VarInt temp_n;
-		vi_copy_create_VarInt(&temp_n, &n);
-#endif
-
-		#pragma omp task shared(maybe_prime) firstprivate(temp_n)
+		// Selfridge's method A: the first D in 5, -7, 9, -11, ... with (D/n) = -1.
+		int dv = 5;
+		VarInt dvar;
+		for(;;)
 		{
-			if(maybe_prime && !fermat(
-#ifdef _OPENMP
-				&temp_n,
-#else
-				&n,
-#endif
-				this))
+			vi_create_from_int_VarInt(&dvar, dv);
+			int const jacobi = vi_jacobi_VarInt(&dvar, this);
+			vi_destroy_VarInt(&dvar);
+			if(jacobi == -1)
+				break;
+			// a common factor, unless D is n itself.
+			if(jacobi == 0
+			&& !(this->size == 1 && this->digits[0] == (digit_t) abs(dv)))
 			{
 				maybe_prime = 0;
+				break;
 			}
+			dv = dv > 0 ? -(dv + 2) : -dv + 2;
+		}
 
-#ifdef _OPENMP
-			vi_destroy_VarInt(&temp_n);
-#endif
+		if(maybe_prime)
+		{
+			// strong Lucas test with P = 1, Q = (1 - D) / 4 and n + 1 = d * 2^s.
+			VarInt p = varint_zero, q = varint_zero, dm = varint_zero;
+			VarInt u = varint_zero, v = varint_zero, qk = varint_zero, t = varint_zero;
+			vi_copy_assign_VarInt(&p, &ctx.r);
+			vi_create_from_int_VarInt(&t, (1 - dv) / 4);
+			internal_to_montgomery_signed_VarInt(&q, &t, &ctx);
+			vi_destroy_VarInt(&t);
+			vi_create_from_int_VarInt(&t, dv);
+			internal_to_montgomery_signed_VarInt(&dm, &t, &ctx);
+
+			vi_add_assign_VarInt(&t, this, &varint_one);
+			s = 0;
+			while(!internal_bit_VarInt(&t, s))
+				++s;
+			vi_shr_assign_VarInt(&d, &t, (int) s);
+
+			internal_lucas_VarInt(&u, &v, &qk, &p, &q, &dm, &d, &ctx, &scratch);
+
+			// n is a strong Lucas probable prime if U_d = 0 or V_(d 2^r) = 0 for some r < s.
+			maybe_prime = !u.size || !v.size;
+			for(size_t r = 1; !maybe_prime && r < s; r++)
+			{
+				internal_montgomery_mul_VarInt(&v, &v, &v, &scratch, &ctx);
+				internal_add_mod_VarInt(&t, &qk, &qk, &ctx.mod);
+				internal_sub_mod_VarInt(&v, &v, &t, &ctx.mod);
+				internal_montgomery_mul_VarInt(&qk, &qk, &qk, &scratch, &ctx);
+				maybe_prime = !v.size;
+			}
+
+			vi_destroy_VarInt(&p);
+			vi_destroy_VarInt(&q);
+			vi_destroy_VarInt(&dm);
+			vi_destroy_VarInt(&u);
+			vi_destroy_VarInt(&v);
+			vi_destroy_VarInt(&qk);
+			vi_destroy_VarInt(&t);
 		}
 	}
 
-	#pragma omp taskwait
+	vi_destroy_VarInt(&n_minus_one);
+	vi_destroy_VarInt(&d);
+	vi_destroy_VarInt(&minus_one);
+	vi_destroy_VarInt(&two);
+	vi_destroy_VarInt(&x);
+	vi_destroy_VarInt(&scratch);
+	vi_destroy_Montgomery(&ctx);
 
-	vi_destroy_VarInt(&n);
 	return maybe_prime;
 }
 
@@ -1438,6 +3728,13 @@ void vi_shl_assign_VarInt(
 	size_t fill = distance / digit_bits;
 	size_t rest = distance % digit_bits;
 
+	if(!src->size)
+	{
+		dest->size = 0;
+		dest->sign = kPos;
+		return;
+	}
+
 	if(dest->capacity < src->size + fill + 1)
 		vi_realloc_digit(
 			&dest->digits,
@@ -1473,6 +3770,346 @@ void vi_shl_assign_VarInt(
 	dest->sign = src->sign;
 }
 
+// prime searches sieve their candidates with the odd primes below this bound.
+#ifndef VI_SIEVE_PRIME_LIMIT
+#define VI_SIEVE_PRIME_LIMIT 16384
+#endif
+#if VI_SIEVE_PRIME_LIMIT < 4 || VI_SIEVE_PRIME_LIMIT > 65536
+#error "VI_SIEVE_PRIME_LIMIT must be between 4 and 65536."
+#endif
+// the number of candidates a prime search sieves at once.
+#ifndef VI_SIEVE_WINDOW
+#define VI_SIEVE_WINDOW 4096
+#endif
+#if VI_SIEVE_WINDOW < 1 || VI_SIEVE_WINDOW > 1048576
+#error "VI_SIEVE_WINDOW must be between 1 and 1048576."
+#endif
+
+/* the odd primes below small_primes_limit, found a segment at a time by a
+sieve of Eratosthenes and shared by all prime searches and tests. The table
+grows for as far as it is asked to. Entries never change once found, and a
+full table is copied into one of twice the size instead of being moved, so
+readers may keep using the copy they were given. Only growing the table is
+serialised, readers find a large enough one through acquire loads of the
+limit, count and table, which are stored in the reverse order. */
+enum { kPrimeSegment = 4096 };
+static uint32_t * small_primes = NULL;
+static size_t small_primes_capacity = 0;
+static size_t small_primes_count = 0;
+static uint32_t small_primes_limit = 3;
+
+// stores a table variable for the acquire loads in internal_small_primes.
+#ifdef __GNUC__
+#define PUBLISH_SMALL_PRIMES(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELEASE)
+#else
+#define PUBLISH_SMALL_PRIMES(var, value) ((var) = (value))
+#endif
+
+// sieves the next segment of odd numbers into the table.
+static void internal_grow_small_primes(void)
+{
+	uint32_t const lo = small_primes_limit;
+	uint32_t const hi = lo > UINT32_MAX - kPrimeSegment
+		? UINT32_MAX
+		: lo + kPrimeSegment;
+
+	// a segment holds at most kPrimeSegment / 2 odd primes.
+	size_t count = small_primes_count;
+	if(small_primes_capacity - count < kPrimeSegment / 2)
+	{
+		// the old table is never freed, as readers may still hold it.
+		size_t const capacity = 2 * small_primes_capacity > count + kPrimeSegment / 2
+			? 2 * small_primes_capacity
+			: count + kPrimeSegment / 2;
+		uint32_t * const primes = malloc(capacity * sizeof(uint32_t));
+		assert(primes != NULL && "malloc failed");
+		if(count)
+			memcpy(primes, small_primes, count * sizeof(uint32_t));
+		small_primes_capacity = capacity;
+		PUBLISH_SMALL_PRIMES(small_primes, primes);
+	}
+
+	unsigned char composite[kPrimeSegment];
+	memset(composite, 0, sizeof(composite));
+
+	// the known primes strike out their odd multiples from p^2 on.
+	for(size_t i = 0; i < count; i++)
+	{
+		uint32_t const p = small_primes[i];
+		if((uint64_t) p * p >= hi)
+			break;
+		uint64_t m = (uint64_t) (lo + p - 1) / p * p;
+		if(m < (uint64_t) p * p)
+			m = (uint64_t) p * p;
+		if(!(m & 1))
+			m += p;
+		for(; m < hi; m += 2 * p)
+			composite[m - lo] = 1;
+	}
+
+	// so do the primes found in this segment itself, before their squares are reached.
+	for(uint32_t n = lo | 1; n < hi; n += 2)
+		if(!composite[n - lo])
+		{
+			small_primes[count++] = n;
+			for(uint64_t m = (uint64_t) n * n; m < hi; m += 2 * n)
+				composite[m - lo] = 1;
+		}
+
+	PUBLISH_SMALL_PRIMES(small_primes_count, count);
+	PUBLISH_SMALL_PRIMES(small_primes_limit, hi);
+}
+
+/* returns the table of odd primes, of which *count are below limit, growing it
+as needed. The table may be null if there are none. */
+static uint32_t const * internal_small_primes(
+	uint32_t limit,
+	size_t * count)
+{
+	uint32_t const * primes = NULL;
+	size_t known = 0;
+	int found = 0;
+
+#ifdef __GNUC__
+	if(__atomic_load_n(&small_primes_limit, __ATOMIC_ACQUIRE) >= limit)
+	{
+		known = __atomic_load_n(&small_primes_count, __ATOMIC_ACQUIRE);
+		primes = __atomic_load_n(&small_primes, __ATOMIC_ACQUIRE);
+		found = 1;
+	}
+#endif
+
+	if(!found)
+	{
+		#pragma omp critical(small_primes)
+		{
+			while(small_primes_limit < limit)
+				internal_grow_small_primes();
+			known = small_primes_count;
+			primes = small_primes;
+		}
+	}
+
+	// the table may reach past limit.
+	while(known && primes[known - 1] >= limit)
+		--known;
+	*count = known;
+	return primes;
+}
+
+// returns |this| mod m, for m <= 2^48.
+static uint64_t internal_mod_small_VarInt(
+	VarInt const * this,
+	uint64_t m)
+{
+	// fold in at most 16 bits at a time, so that r << 16 fits 64 bits.
+	enum { kStep = DIGIT_BITS < 16 ? DIGIT_BITS : 16 };
+	uint64_t r = 0;
+	for(size_t i = this->size; i--;)
+		for(size_t b = DIGIT_BITS; b;)
+		{
+			b -= kStep;
+			uint64_t const piece = (uint64_t) (this->digits[i] >> b) & ((1u << kStep) - 1);
+			r = ((r << kStep) | piece) % m;
+		}
+	return r;
+}
+
+// the small primes and the residues of a prime search's current window.
+typedef struct
+{
+	uint32_t const * primes;
+	uint32_t * residues;
+	size_t count;
+	// the distance between candidates, 2 or 4.
+	uint32_t step;
+	// whether (candidate - 1) / 2 must be prime as well.
+	int safe;
+	unsigned char * sieve;
+	size_t * survivors;
+} PrimeSearch;
+
+static void internal_create_PrimeSearch(
+	PrimeSearch * this,
+	uint32_t step,
+	int safe)
+{
+	this->primes = internal_small_primes(VI_SIEVE_PRIME_LIMIT, &this->count);
+	this->step = step;
+	this->safe = safe;
+	this->residues = NULL;
+	this->sieve = NULL;
+	this->survivors = NULL;
+	vi_malloc(
+		(void**)&this->residues,
+		sizeof(uint32_t),
+		this->count);
+	vi_malloc(
+		(void**)&this->sieve,
+		1,
+		VI_SIEVE_WINDOW);
+	vi_malloc(
+		(void**)&this->survivors,
+		sizeof(size_t),
+		VI_SIEVE_WINDOW);
+}
+
+static void internal_destroy_PrimeSearch(
+	PrimeSearch * this)
+{
+	vi_free((void**)&this->residues);
+	vi_free((void**)&this->sieve);
+	vi_free((void**)&this->survivors);
+}
+
+// computes the residues of the window starting at first.
+static void internal_reset_PrimeSearch(
+	PrimeSearch * this,
+	VarInt const * first)
+{
+	for(size_t i = 0; i < this->count; i++)
+		this->residues[i] = (uint32_t) internal_mod_small_VarInt(first, this->primes[i]);
+}
+
+// moves the residues on to the next window.
+static void internal_advance_PrimeSearch(
+	PrimeSearch * this)
+{
+	for(size_t i = 0; i < this->count; i++)
+		this->residues[i] = (uint32_t) ((this->residues[i]
+			+ (uint64_t) this->step * VI_SIEVE_WINDOW) % this->primes[i]);
+}
+
+/* marks the offsets j with first + step * j = target mod p. small is first if
+that has at most 18 bits, else 0; the candidate equal to except is not marked. */
+static void internal_mark_PrimeSearch(
+	PrimeSearch * this,
+	uint32_t p,
+	uint32_t residue,
+	uint32_t target,
+	size_t small,
+	size_t except)
+{
+	// j = (target - residue) / step mod p.
+	uint64_t const half = (p + 1) / 2;
+	uint64_t const inverse = this->step == 2 ? half : half * half % p;
+	size_t j = (size_t) ((target + (uint64_t) p - residue) % p * inverse % p);
+	if(small + this->step * j == except)
+		j += p;
+	for(; j < VI_SIEVE_WINDOW; j += p)
+		this->sieve[j] = 1;
+}
+
+/* sieves the window starting at first, returns the number of survivors.
+For safe primes, candidates with (candidate - 1) / 2 divisible by p, that is
+candidate = 1 mod p, are removed as well. */
+static size_t internal_sieve_PrimeSearch(
+	PrimeSearch * this,
+	VarInt const * first)
+{
+	// small candidates may be a sieving prime p, or 2p + 1 in a safe prime search.
+	size_t const bits = internal_bit_length_VarInt(first);
+	size_t small = 0;
+	if(bits <= 18)
+	{
+		small = (size_t) internal_mod_small_VarInt(first, 1u << 16);
+		for(size_t b = 16; b < bits; b++)
+			small |= (size_t) internal_bit_VarInt(first, b) << b;
+	}
+
+	memset(this->sieve, 0, VI_SIEVE_WINDOW);
+	for(size_t i = 0; i < this->count; i++)
+	{
+		uint32_t const p = this->primes[i];
+		internal_mark_PrimeSearch(this, p, this->residues[i], 0, small, p);
+		if(this->safe)
+			internal_mark_PrimeSearch(this, p, this->residues[i], 1, small, 2 * (size_t) p + 1);
+	}
+
+	size_t count = 0;
+	for(size_t j = 0; j < VI_SIEVE_WINDOW; j++)
+		if(!this->sieve[j])
+			this->survivors[count++] = j;
+	return count;
+}
+
+// first + step * j, for an offset j into the window.
+static void internal_offset_PrimeSearch(
+	PrimeSearch const * this,
+	VarInt * dest,
+	VarInt const * first,
+	size_t j)
+{
+	VarInt offset;
+	vi_create_from_int_VarInt(&offset, (int) (this->step * j));
+	vi_add_assign_VarInt(dest, first, &offset);
+	vi_destroy_VarInt(&offset);
+}
+
+/* tests the survivors of the window starting at first concurrently, in
+increasing order, and returns the lowest offset found to be prime, or SIZE_MAX.
+best is the lowest such offset so far: tests of higher offsets are skipped,
+or abandoned between rounds, but all lower ones run to completion. In a safe
+prime search, both the candidate and its half get a single round before
+either is tested in full. */
+static size_t internal_test_PrimeSearch(
+	PrimeSearch const * this,
+	VarInt const * first,
+	size_t survivor_count)
+{
+	size_t best = SIZE_MAX;
+
+	#pragma omp parallel
+	{
+		VarInt test = varint_zero, half = varint_zero;
+		MillerRabinScratch work;
+		internal_create_MillerRabinScratch(&work);
+
+		#pragma omp for schedule(dynamic, 1)
+		for(size_t k = 0; k < survivor_count; k++)
+		{
+			size_t const j = this->survivors[k];
+			if(internal_atomic_read(&best) < j)
+				continue;
+
+			internal_offset_PrimeSearch(this, &test, first, j);
+
+			int prime;
+			if(this->safe)
+			{
+				vi_shr_assign_VarInt(&half, &test, 1);
+				prime = internal_is_prime_miller_rabin_VarInt(&half, 1, &best, j, &work)
+					&& internal_is_prime_miller_rabin_VarInt(&test, 1, &best, j, &work)
+					&& internal_is_prime_miller_rabin_VarInt(&half, VI_MILLER_RABIN_ROUNDS, &best, j, &work)
+					&& internal_is_prime_miller_rabin_VarInt(&test, VI_MILLER_RABIN_ROUNDS, &best, j, &work);
+			} else
+				prime = internal_is_prime_miller_rabin_VarInt(&test, VI_MILLER_RABIN_ROUNDS, &best, j, &work);
+
+			if(prime)
+			{
+				#pragma omp critical(prime_search)
+				if(j < best)
+				{
+					#pragma omp atomic write
+					best = j;
+				}
+			}
+		}
+
+		vi_destroy_VarInt(&test);
+		vi_destroy_VarInt(&half);
+		internal_destroy_MillerRabinScratch(&work);
+		// the workers may end with the region, and their scratch and heaps with them.
+		vi_trim_scratch();
+#ifdef _OPENMP
+		if(omp_get_thread_num())
+			vi_release_thread_heap();
+#endif
+	}
+
+	return best;
+}
+
 void vi_next_prime_assign_VarInt(
 	VarInt * dest,
 	VarInt const * start)
@@ -1480,17 +4117,306 @@ void vi_next_prime_assign_VarInt(
 	assert(dest != NULL);
 	assert(start != NULL);
 
+	if(vi_compare_VarInt(start, &varint_two) <= 0)
+	{
+		vi_copy_assign_VarInt(dest, &varint_two);
+		return;
+	}
+
+	// candidate is the first odd number of the current window.
+	VarInt candidate = varint_zero;
 	if(vi_is_even_VarInt(start))
+		vi_inc_assign_VarInt(&candidate, start);
+	else
+		vi_copy_assign_VarInt(&candidate, start);
+
+	PrimeSearch search;
+	internal_create_PrimeSearch(&search, 2, 0);
+	internal_reset_PrimeSearch(&search, &candidate);
+
+	for(;;)
 	{
-		vi_inc_assign_VarInt(dest, start);
-	} else
-		vi_copy_assign_VarInt(dest, start);
+		size_t const survivors = internal_sieve_PrimeSearch(&search, &candidate);
+		size_t const best = internal_test_PrimeSearch(&search, &candidate, survivors);
+		if(best != SIZE_MAX)
+		{
+			internal_offset_PrimeSearch(&search, &candidate, &candidate, best);
+			break;
+		}
+
+		internal_offset_PrimeSearch(&search, &candidate, &candidate, VI_SIEVE_WINDOW);
+		internal_advance_PrimeSearch(&search);
+	}
+
+	vi_destroy_VarInt(dest);
+	*dest = candidate;
+
+	internal_destroy_PrimeSearch(&search);
+}
+
+// this = a random number of exactly bits bits, with its top bits set.
+static void internal_random_bits_VarInt(
+	VarInt * this,
+	size_t bits,
+	size_t top)
+{
+	size_t const size = (bits + DIGIT_BITS - 1) / DIGIT_BITS;
+	vi_assign_random_VarInt(this, size * sizeof(digit_t));
+	for(size_t i = this->size; i < size; i++)
+		this->digits[i] = 0;
+	this->size = size;
+
+	size_t const rest = bits - (size - 1) * DIGIT_BITS;
+	if(rest < DIGIT_BITS)
+		this->digits[size - 1] &= ((digit_t) 1 << rest) - 1;
+
+	for(size_t i = bits - top; i < bits; i++)
+		this->digits[i / DIGIT_BITS] |= (digit_t) 1 << (i % DIGIT_BITS);
+}
+
+void vi_random_prime_VarInt(
+	VarInt * dest,
+	size_t bits,
+	int flags)
+{
+	assert(dest != NULL);
+	int const safe = (flags & kPrimeSafe) != 0;
+	size_t const top = flags & kPrimeTopTwoBits ? 2 : 1;
+	assert(bits >= (safe ? 3 : 2));
+	// there are no 4 or 5 bit safe primes with both top bits set.
+	assert(!safe || top == 1 || bits >= 6);
+
+	/* candidates are odd, and 3 mod 4 for safe primes, whose halves are odd.
+	A window that holds no prime, or whose prime no longer has the requested
+	top bits, is dropped for a fresh random start. */
+	PrimeSearch search;
+	internal_create_PrimeSearch(&search, safe ? 4 : 2, safe);
+
+	VarInt candidate = varint_zero;
+	for(;;)
+	{
+		internal_random_bits_VarInt(&candidate, bits, top);
+		candidate.digits[0] |= safe ? 3 : 1;
+
+		internal_reset_PrimeSearch(&search, &candidate);
+		size_t const survivors = internal_sieve_PrimeSearch(&search, &candidate);
+		size_t const best = internal_test_PrimeSearch(&search, &candidate, survivors);
+		if(best == SIZE_MAX)
+			continue;
+
+		internal_offset_PrimeSearch(&search, &candidate, &candidate, best);
+		if(internal_bit_length_VarInt(&candidate) != bits
+		|| (top == 2 && !internal_bit_VarInt(&candidate, bits - 2)))
+			continue;
+
+		break;
+	}
+
+	vi_destroy_VarInt(dest);
+	*dest = candidate;
+
+	internal_destroy_PrimeSearch(&search);
+}
+
+/* primorial block k is the product of the odd primes below VI_SIEVE_PRIME_LIMIT,
+from 3 on, for as long as it has at most 2^k bits. The blocks are built on
+first use and kept for the lifetime of the process. */
+enum { kPrimorialBlocks = 16 };
+static VarInt primorial_blocks[kPrimorialBlocks];
+static int primorial_blocks_ready[kPrimorialBlocks];
+
+static VarInt const * internal_primorial_block(
+	size_t k)
+{
+	assert(k < kPrimorialBlocks);
+
+#ifdef __GNUC__
+	// a built block is read without the lock, the release store below publishes it.
+	if(__atomic_load_n(&primorial_blocks_ready[k], __ATOMIC_ACQUIRE))
+		return &primorial_blocks[k];
+#endif
+
+	#pragma omp critical(primorial)
+	if(!primorial_blocks_ready[k])
+	{
+		// the primes below 2^k have a product of about 1.44 * 2^k bits.
+		size_t count;
+		uint32_t const * const primes = internal_small_primes(
+			k < 16 && ((uint32_t) 1 << k) < VI_SIEVE_PRIME_LIMIT
+				? (uint32_t) 1 << k
+				: VI_SIEVE_PRIME_LIMIT,
+			&count);
+
+		VarInt block = varint_zero, next = varint_zero, p;
+		vi_copy_assign_VarInt(&block, &varint_one);
+		for(size_t i = 0; i < count; i++)
+		{
+			vi_create_from_int_VarInt(&p, (int) primes[i]);
+			vi_mul_assign_VarInt(&next, &block, &p);
+			vi_destroy_VarInt(&p);
+			if(internal_bit_length_VarInt(&next) > (size_t) 1 << k)
+				break;
+			vi_copy_assign_VarInt(&block, &next);
+		}
+		vi_destroy_VarInt(&next);
+
+		// the cache lives outside the vi_malloc heaps, so vi_destroy_heap finds them empty.
+		digit_t * const digits = malloc(block.size * sizeof(digit_t));
+		assert(digits != NULL && "malloc failed");
+		memcpy(digits, block.digits, block.size * sizeof(digit_t));
+		primorial_blocks[k] = digits_view(digits, block.size);
+		vi_destroy_VarInt(&block);
+#ifdef __GNUC__
+		__atomic_store_n(&primorial_blocks_ready[k], 1, __ATOMIC_RELEASE);
+#else
+		primorial_blocks_ready[k] = 1;
+#endif
+	}
+
+	return &primorial_blocks[k];
+}
+
+/* returns 0 if this, which must have more than 64 bits, shares a factor with
+the primorial block sized to it: one remainder and one gcd reject the
+multiples of all primes in the block at once. */
+static int internal_primorial_test_VarInt(
+	VarInt const * this)
+{
+	size_t k = 0;
+	for(size_t bits = internal_bit_length_VarInt(this); bits > 1; bits >>= 1)
+		++k;
+	if(k >= kPrimorialBlocks)
+		k = kPrimorialBlocks - 1;
+	VarInt const * const block = internal_primorial_block(k);
+
+	VarInt r = varint_zero, g = varint_zero;
+	vi_div_mod_assign_VarInt(NULL, &r, this, block);
+	vi_gcd_assign_VarInt(&g, block, &r);
+	int const coprime = !vi_compare_VarInt(&g, &varint_one);
+	vi_destroy_VarInt(&r);
+	vi_destroy_VarInt(&g);
+
+	return coprime;
+}
+
+int vi_is_prime_quick_VarInt(
+	VarInt const * this)
+{
+	assert(this != NULL);
+	assert(this->sign == kPos);
+
+	if(internal_bit_length_VarInt(this) > 64 && !internal_primorial_test_VarInt(this))
+		return 0;
+
+	return vi_is_prime_miller_rabin_VarInt(this, VI_MILLER_RABIN_ROUNDS);
+}
+
+/* the odd primes below VI_SIEVE_PRIME_LIMIT, multiplied into groups below
+2^48, so that trial division takes one pass over a number per group. */
+typedef struct
+{
+	uint32_t const * primes;
+	size_t count;
+	uint64_t * products;
+	// group i ends before primes[ends[i]].
+	size_t * ends;
+	size_t groups;
+} TrialDivision;
+
+static void internal_create_TrialDivision(
+	TrialDivision * this)
+{
+	this->primes = internal_small_primes(VI_SIEVE_PRIME_LIMIT, &this->count);
+	this->products = NULL;
+	this->ends = NULL;
+	vi_malloc(
+		(void**)&this->products,
+		sizeof(uint64_t),
+		this->count);
+	vi_malloc(
+		(void**)&this->ends,
+		sizeof(size_t),
+		this->count);
+
+	this->groups = 0;
+	uint64_t product = 1;
+	for(size_t i = 0; i < this->count; i++)
+	{
+		if(product * this->primes[i] >= (uint64_t) 1 << 48)
+		{
+			this->products[this->groups] = product;
+			this->ends[this->groups++] = i;
+			product = 1;
+		}
+		product *= this->primes[i];
+	}
+	this->products[this->groups] = product;
+	this->ends[this->groups++] = this->count;
+}
+
+static void internal_destroy_TrialDivision(
+	TrialDivision * this)
+{
+	vi_free((void**)&this->products);
+	vi_free((void**)&this->ends);
+}
 
-	while(!vi_is_prime_quick_VarInt(dest))
+// returns 0 if one of the primes divides this, which must have more than 32 bits.
+static int internal_trial_divide_VarInt(
+	VarInt const * this,
+	TrialDivision const * trial)
+{
+	size_t begin = 0;
+	for(size_t g = 0; g < trial->groups; g++)
+	{
+		uint64_t const r = internal_mod_small_VarInt(this, trial->products[g]);
+		for(size_t i = begin; i < trial->ends[g]; i++)
+			if(!(r % trial->primes[i]))
+				return 0;
+		begin = trial->ends[g];
+	}
+	return 1;
+}
+
+void vi_is_prime_batch_VarInt(
+	VarInt const * const * cands,
+	size_t n,
+	int * out)
+{
+	assert(cands != NULL || !n);
+	assert(out != NULL || !n);
+
+	TrialDivision trial;
+	internal_create_TrialDivision(&trial);
+
+	// one parallel region for the whole batch, each thread keeps its work space.
+	#pragma omp parallel
 	{
-		// increment in steps of two.
-		vi_add_assign_VarInt(dest, dest, &varint_two);
+		MillerRabinScratch work;
+		internal_create_MillerRabinScratch(&work);
+
+		#pragma omp for schedule(dynamic, 1)
+		for(size_t i = 0; i < n; i++)
+		{
+			VarInt const * const cand = cands[i];
+			assert(cand != NULL);
+			assert(cand->sign == kPos);
+
+			// trial division covers every prime of the primorial test, so it runs alone.
+			out[i] = (internal_bit_length_VarInt(cand) <= 64
+					|| internal_trial_divide_VarInt(cand, &trial))
+				&& internal_is_prime_miller_rabin_VarInt(cand, VI_MILLER_RABIN_ROUNDS, NULL, 0, &work);
+		}
+
+		internal_destroy_MillerRabinScratch(&work);
+		vi_trim_scratch();
+#ifdef _OPENMP
+		if(omp_get_thread_num())
+			vi_release_thread_heap();
+#endif
 	}
+
+	internal_destroy_TrialDivision(&trial);
 }
 
 int vi_is_even_VarInt(
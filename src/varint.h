@@ -4,14 +4,38 @@
 #include <limits.h>
 #include "defines.h"
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-typedef unsigned char digit_t;
-#define DIGIT_MAX UCHAR_MAX
-#define DIGIT_BITS (sizeof(digit_t) * 8)
+/* The limb width can be selected at build time with -DVI_DIGIT_BITS=(8|32|64).
+64 bit limbs need a compiler with a 128 bit integer type for the intermediate products. */
+#ifndef VI_DIGIT_BITS
+	#ifdef __SIZEOF_INT128__
+		#define VI_DIGIT_BITS 64
+	#else
+		#define VI_DIGIT_BITS 32
+	#endif
+#endif
+
+#if VI_DIGIT_BITS == 64
+	#ifndef __SIZEOF_INT128__
+		#error "64 bit digits require unsigned __int128 support."
+	#endif
+	typedef uint64_t digit_t;
+	#define DIGIT_MAX UINT64_MAX
+#elif VI_DIGIT_BITS == 32
+	typedef uint32_t digit_t;
+	#define DIGIT_MAX UINT32_MAX
+#elif VI_DIGIT_BITS == 8
+	typedef unsigned char digit_t;
+	#define DIGIT_MAX UCHAR_MAX
+#else
+	#error "VI_DIGIT_BITS must be 8, 32, or 64."
+#endif
+#define DIGIT_BITS VI_DIGIT_BITS
 
 typedef enum {
 	kPos,
@@ -26,6 +50,21 @@ typedef struct
 	sign_t sign;
 } VarInt;
 
+/* Montgomery context for an odd modulus n, with R = 2^(DIGIT_BITS * n.size).
+Numbers in Montgomery form are x * R mod n, and multiply without division. */
+typedef struct
+{
+	VarInt mod;
+	// R mod n, the Montgomery form of 1.
+	VarInt r;
+	// R^2 mod n, converts numbers into Montgomery form.
+	VarInt r2;
+	// -n^-1 mod R, used by moduli past VI_REDC_THRESHOLD digits.
+	VarInt inv;
+	// -n^-1 mod 2^DIGIT_BITS.
+	digit_t inv_digit;
+} Montgomery;
+
 void vi_create_VarInt(
 	VarInt * this);
 
@@ -86,6 +125,13 @@ void vi_mul_assign_VarInt(
 	VarInt const * srca,
 	VarInt const * srcb);
 
+void vi_sqr_create_VarInt(
+	VarInt * dest,
+	VarInt const * src);
+void vi_sqr_assign_VarInt(
+	VarInt * dest,
+	VarInt const * src);
+
 void vi_div_mod_create_VarInt(
 	VarInt * quo,
 	VarInt * rem,
@@ -97,6 +143,12 @@ void vi_div_mod_assign_VarInt(
 	VarInt const * srca,
 	VarInt const * srcb);
 
+/** Computes floor(2^bits / |src|) with Newton's method, the result has the sign of src. */
+void vi_reciprocal_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	size_t bits);
+
 void vi_dec_assign_VarInt(
 	VarInt * dest,
 	VarInt const * src);
@@ -134,6 +186,36 @@ void vi_pow_mod_create_VarInt(
 	VarInt const * exp,
 	VarInt const * mod);
 
+/** Prepares a Montgomery context for |mod|, which must be odd. */
+void vi_create_Montgomery(
+	Montgomery * this,
+	VarInt const * mod);
+void vi_destroy_Montgomery(
+	Montgomery * this);
+
+/** dest = |src| * R mod n. */
+void vi_to_montgomery_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx);
+/** dest = src / R mod n, src must be in Montgomery form. */
+void vi_from_montgomery_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx);
+
+/** dest = srca * srcb / R mod n, both sources in Montgomery form. */
+void vi_montgomery_mul_assign_VarInt(
+	VarInt * dest,
+	VarInt const * srca,
+	VarInt const * srcb,
+	Montgomery const * ctx);
+/** dest = src^2 / R mod n, src in Montgomery form. */
+void vi_montgomery_sqr_assign_VarInt(
+	VarInt * dest,
+	VarInt const * src,
+	Montgomery const * ctx);
+
 void vi_shr_assign_VarInt(
 	VarInt * dest,
 	VarInt const * src,
@@ -147,13 +229,70 @@ void vi_shl_assign_VarInt(
 int vi_is_prime_quick_VarInt(
 	VarInt const * this);
 
+/** Miller-Rabin test, exact below 3.3 * 10^24. Larger numbers are tested
+with the given number of random bases, composites pass with a chance of at most 4^-rounds.
+0 rounds selects the default, VI_MILLER_RABIN_ROUNDS (24). */
+int vi_is_prime_miller_rabin_VarInt(
+	VarInt const * this,
+	size_t rounds);
+
+/** out[i] = vi_is_prime_quick_VarInt(cands[i]) for i < n. The candidates share
+one table of small primes for trial division, and are tested concurrently. */
+void vi_is_prime_batch_VarInt(
+	VarInt const * const * cands,
+	size_t n,
+	int * out);
+
+/** Baillie-PSW test: a strong base 2 test and a strong Lucas test, no composite is known to pass. */
+int vi_is_prime_bpsw_VarInt(
+	VarInt const * this);
+
+/** dest = gcd(|a|, |b|), which is 0 only if both are 0. */
+void vi_gcd_assign_VarInt(
+	VarInt * dest,
+	VarInt const * a,
+	VarInt const * b);
+
+/** Jacobi symbol (a/n) for odd positive n, returns -1, 0 or 1. */
+int vi_jacobi_VarInt(
+	VarInt const * a,
+	VarInt const * n);
+
+/** u = U_k, v = V_k mod n of the Lucas sequences with parameters p and q, n must be odd. */
+void vi_lucas_VarInt(
+	VarInt * u,
+	VarInt * v,
+	VarInt const * p,
+	VarInt const * q,
+	VarInt const * k,
+	VarInt const * mod);
+
 void vi_next_prime_assign_VarInt(
 	VarInt * dest,
 	VarInt const * start);
 
+typedef enum {
+	// the second highest bit is set as well, so products of two such primes have exactly twice the bits.
+	kPrimeTopTwoBits = 1,
+	// (p - 1) / 2 is prime as well.
+	kPrimeSafe = 2
+} prime_flags_t;
+
+/** dest = a random odd probable prime of exactly bits bits, flags is a combination of prime_flags_t.
+Safe primes need at least 3 bits, or 6 with kPrimeTopTwoBits. They are 3 mod 4, so 5 is never returned. */
+void vi_random_prime_VarInt(
+	VarInt * dest,
+	size_t bits,
+	int flags);
+
 int vi_is_even_VarInt(
 	VarInt const * this);
 
+/** Frees the calling thread's scratch digits, which its operations otherwise
+keep for reuse. Threads about to end, such as OpenMP workers before their pool
+is torn down, should call it. */
+void vi_trim_scratch(void);
+
 void vi_calloc_digit(
 	digit_t ** ptr,
 	size_t count);
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+
+/* Checks vi_div_mod_assign_VarInt on dividends a = q * b + r built from a known
+quotient q and remainder r, 0 <= r < |b|. The division truncates, so the
+quotient takes the sign of a * b and the remainder the sign of a. The lengths
+of b and q are placed around the thresholds of the division tiers, which the
+div_low and div_newton tests force down to a few digits. */
+
+// the defaults of varint.c.
+#ifndef VI_BURNIKEL_ZIEGLER_THRESHOLD
+#define VI_BURNIKEL_ZIEGLER_THRESHOLD 40
+#endif
+#ifndef VI_BURNIKEL_ZIEGLER_OFFSET
+#define VI_BURNIKEL_ZIEGLER_OFFSET 20
+#endif
+
+enum { kTrials = 4 };
+
+static uint64_t state = 0x9e3779b97f4a7c15u;
+
+static uint64_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static void fill(
+	digit_t * digits,
+	size_t n)
+{
+	int const mode = (int) (next_random() % 4);
+	for(size_t i = 0; i < n; i++)
+	{
+		digit_t const r = (digit_t) next_random();
+		switch(mode)
+		{
+		case 0: digits[i] = r; break;
+		case 1: digits[i] = (digit_t) ~(digit_t) 0; break;
+		case 2: digits[i] = next_random() % 8 ? (digit_t) ~(digit_t) 0 : r; break;
+		default: digits[i] = next_random() % 8 ? 0 : r; break;
+		}
+	}
+}
+
+static void create_digits(
+	VarInt * this,
+	digit_t const * digits,
+	size_t n,
+	sign_t sign)
+{
+	while(n && !digits[n-1])
+		n--;
+	vi_create_VarInt(this);
+	if(n)
+		vi_copy_digit(&this->digits, digits, this->capacity = n);
+	this->size = n;
+	this->sign = n ? sign : kPos;
+}
+
+static size_t failures = 0, count = 0;
+
+static void expect(
+	char const * what,
+	VarInt const * got,
+	VarInt const * want,
+	size_t bn,
+	size_t qn)
+{
+	count++;
+	if(vi_compare_VarInt(got, want))
+	{
+		failures++;
+		fprintf(stderr, "wrong %s: divisor of %zu digits, quotient of %zu digits\n", what, bn, qn);
+	}
+}
+
+static void check_div(
+	size_t bn,
+	size_t qn)
+{
+	digit_t * const digits = malloc((bn + qn + 1) * sizeof(digit_t));
+	sign_t const sa = next_random() % 2 ? kNeg : kPos;
+	sign_t const sb = next_random() % 2 ? kNeg : kPos;
+	sign_t const sq = sa == sb ? kPos : kNeg;
+
+	VarInt b, q, r, a;
+	fill(digits, bn);
+	if(!digits[bn-1])
+		digits[bn-1] = 1;
+	digit_t const top = digits[bn-1];
+	create_digits(&b, digits, bn, sb);
+
+	fill(digits, qn);
+	create_digits(&q, digits, qn, sq);
+
+	// r < |b|, as its top digit is below that of b.
+	fill(digits, bn);
+	digits[bn-1] = next_random() % 4 ? (digit_t) (digits[bn-1] % top) : top - 1;
+	create_digits(&r, digits, bn, sa);
+
+	vi_mul_create_VarInt(&a, &q, &b);
+	a.sign = kPos;
+	r.sign = kPos;
+	vi_add_assign_VarInt(&a, &a, &r);
+	a.sign = a.size ? sa : kPos;
+	r.sign = r.size ? sa : kPos;
+
+	VarInt quo, rem;
+	vi_div_mod_create_VarInt(&quo, &rem, &a, &b);
+	expect("quotient", &quo, &q, bn, qn);
+	expect("remainder", &rem, &r, bn, qn);
+
+	// a single result, and results that replace the sources.
+	vi_div_mod_assign_VarInt(&quo, NULL, &a, &b);
+	expect("quotient alone", &quo, &q, bn, qn);
+	vi_div_mod_assign_VarInt(NULL, &rem, &a, &b);
+	expect("remainder alone", &rem, &r, bn, qn);
+	vi_copy_assign_VarInt(&quo, &a);
+	vi_copy_assign_VarInt(&rem, &b);
+	vi_div_mod_assign_VarInt(&quo, &rem, &quo, &rem);
+	expect("quotient in place", &quo, &q, bn, qn);
+	expect("remainder in place", &rem, &r, bn, qn);
+
+	vi_destroy_VarInt(&quo);
+	vi_destroy_VarInt(&rem);
+	vi_destroy_VarInt(&a);
+	vi_destroy_VarInt(&b);
+	vi_destroy_VarInt(&q);
+	vi_destroy_VarInt(&r);
+	free(digits);
+}
+
+/* Algorithm D corrects a quotient digit estimate that is one too large by
+adding the divisor back. This dividend and divisor force it, the result is
+checked by the definition of the division. */
+static void check_add_back(void)
+{
+	digit_t const h = (digit_t) (DIGIT_MAX / 2 + 1);
+	digit_t const u[] = { 3, 0, h }, v[] = { 1, 0, h / 4 };
+
+	VarInt a, b, quo, rem, p;
+	create_digits(&a, u, 3, kPos);
+	create_digits(&b, v, 3, kPos);
+	vi_div_mod_create_VarInt(&quo, &rem, &a, &b);
+
+	// a = quo * b + rem, 0 <= rem < b.
+	vi_mul_create_VarInt(&p, &quo, &b);
+	vi_add_assign_VarInt(&p, &p, &rem);
+	count++;
+	if(vi_compare_VarInt(&p, &a)
+	|| rem.sign != kPos
+	|| vi_compare_VarInt(&rem, &b) >= 0)
+	{
+		failures++;
+		fprintf(stderr, "wrong division with add back\n");
+	}
+
+	vi_destroy_VarInt(&a);
+	vi_destroy_VarInt(&b);
+	vi_destroy_VarInt(&quo);
+	vi_destroy_VarInt(&rem);
+	vi_destroy_VarInt(&p);
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+
+	// the quotient is shorter than qn if its random digits end in zeros.
+	static size_t const divisors[] = {
+		1, 2, 3, 4, 7, 16, 33,
+		VI_BURNIKEL_ZIEGLER_THRESHOLD - 1, VI_BURNIKEL_ZIEGLER_THRESHOLD,
+		VI_BURNIKEL_ZIEGLER_THRESHOLD + 1, 2 * VI_BURNIKEL_ZIEGLER_THRESHOLD + 1,
+		5 * VI_BURNIKEL_ZIEGLER_THRESHOLD + 3
+	};
+	static size_t const quotients[] = {
+		0, 1, 2, 3, 5, 16, 33,
+		VI_BURNIKEL_ZIEGLER_OFFSET - 1, VI_BURNIKEL_ZIEGLER_OFFSET,
+		VI_BURNIKEL_ZIEGLER_OFFSET + 1, 4 * VI_BURNIKEL_ZIEGLER_THRESHOLD + 7
+	};
+
+	for(size_t i = 0; i < sizeof(divisors) / sizeof(*divisors); i++)
+		for(size_t j = 0; j < sizeof(quotients) / sizeof(*quotients); j++)
+			for(size_t t = 0; t < kTrials; t++)
+				check_div(divisors[i], quotients[j]);
+	check_add_back();
+
+	printf("%zu of %zu quotients and remainders wrong\n", failures, count);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
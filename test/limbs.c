@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../src/varint.h"
+#include "../src/limbs.h"
+
+/* Checks the dispatched limb kernels against plain C versions of them, with
+dest separate from and aliased to the sources, and the selected schoolbook
+product against vi_mul_basecase_reference. The operands mix random digits
+with runs of zeros and all-ones digits, which make carries ripple. */
+
+// the basecase only picks the vector kernel from this many digits on.
+#ifndef VI_IFMA_THRESHOLD
+#define VI_IFMA_THRESHOLD 16
+#endif
+
+// double width digit type, holds the full product of two digits.
+#if DIGIT_BITS == 64
+__extension__ typedef unsigned __int128 ddigit_t;
+#elif DIGIT_BITS == 32
+typedef uint64_t ddigit_t;
+#else
+typedef uint16_t ddigit_t;
+#endif
+
+enum { kMaxDigits = 300, kTrials = 50 };
+
+static uint64_t state = 0x9e3779b97f4a7c15u;
+
+static uint64_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static void fill(
+	digit_t * digits,
+	size_t n)
+{
+	int const mode = (int) (next_random() % 4);
+	for(size_t i = 0; i < n; i++)
+	{
+		digit_t const r = (digit_t) next_random();
+		switch(mode)
+		{
+		case 0: digits[i] = r; break;
+		case 1: digits[i] = (digit_t) ~(digit_t) 0; break;
+		case 2: digits[i] = next_random() % 8 ? (digit_t) ~(digit_t) 0 : r; break;
+		default: digits[i] = next_random() % 8 ? 0 : r; break;
+		}
+	}
+}
+
+static digit_t add_n_ref(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const sum = (ddigit_t) a[i] + b[i] + carry;
+		dest[i] = (digit_t) sum;
+		carry = (digit_t) (sum >> DIGIT_BITS);
+	}
+	return carry;
+}
+
+static digit_t sub_n_ref(
+	digit_t * dest,
+	digit_t const * a,
+	digit_t const * b,
+	size_t n)
+{
+	digit_t borrow = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const diff = (ddigit_t) a[i] - b[i] - borrow;
+		dest[i] = (digit_t) diff;
+		borrow = (digit_t) (diff >> DIGIT_BITS) & 1;
+	}
+	return borrow;
+}
+
+static digit_t addmul_1_ref(
+	digit_t * dest,
+	digit_t const * a,
+	size_t n,
+	digit_t m)
+{
+	digit_t carry = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		ddigit_t const product = (ddigit_t) a[i] * m + dest[i] + carry;
+		dest[i] = (digit_t) product;
+		carry = (digit_t) (product >> DIGIT_BITS);
+	}
+	return carry;
+}
+
+static size_t failures = 0, count = 0;
+
+static void expect(
+	char const * what,
+	size_t n,
+	digit_t const * got,
+	digit_t got_carry,
+	digit_t const * want,
+	digit_t want_carry)
+{
+	count++;
+	if(got_carry != want_carry || memcmp(got, want, n * sizeof(digit_t)))
+	{
+		failures++;
+		fprintf(stderr, "%s differs for %zu digits\n", what, n);
+	}
+}
+
+static void check_kernels(
+	size_t n)
+{
+	static digit_t a[kMaxDigits], b[kMaxDigits], want[kMaxDigits], got[kMaxDigits];
+	fill(a, n);
+	fill(b, n);
+	digit_t const m = next_random() % 4 ? (digit_t) next_random() : (digit_t) ~(digit_t) 0;
+	digit_t c;
+
+	c = add_n_ref(want, a, b, n);
+	expect("vi_add_n", n, got, vi_add_n(got, a, b, n), want, c);
+	memcpy(got, a, n * sizeof(digit_t));
+	expect("vi_add_n, dest = a", n, got, vi_add_n(got, got, b, n), want, c);
+	memcpy(got, b, n * sizeof(digit_t));
+	expect("vi_add_n, dest = b", n, got, vi_add_n(got, a, got, n), want, c);
+
+	c = sub_n_ref(want, a, b, n);
+	expect("vi_sub_n", n, got, vi_sub_n(got, a, b, n), want, c);
+	memcpy(got, a, n * sizeof(digit_t));
+	expect("vi_sub_n, dest = a", n, got, vi_sub_n(got, got, b, n), want, c);
+	memcpy(got, b, n * sizeof(digit_t));
+	expect("vi_sub_n, dest = b", n, got, vi_sub_n(got, a, got, n), want, c);
+
+	memset(want, 0, n * sizeof(digit_t));
+	c = addmul_1_ref(want, a, n, m);
+	expect("vi_mul_1", n, got, vi_mul_1(got, a, n, m), want, c);
+	memcpy(got, a, n * sizeof(digit_t));
+	expect("vi_mul_1, dest = a", n, got, vi_mul_1(got, got, n, m), want, c);
+
+	memcpy(want, b, n * sizeof(digit_t));
+	c = addmul_1_ref(want, a, n, m);
+	memcpy(got, b, n * sizeof(digit_t));
+	expect("vi_addmul_1", n, got, vi_addmul_1(got, a, n, m), want, c);
+	memcpy(want, a, n * sizeof(digit_t));
+	c = addmul_1_ref(want, a, n, m);
+	memcpy(got, a, n * sizeof(digit_t));
+	expect("vi_addmul_1, dest = a", n, got, vi_addmul_1(got, got, n, m), want, c);
+}
+
+static void check_basecase(
+	size_t an,
+	size_t bn)
+{
+	static digit_t a[kMaxDigits], b[kMaxDigits], want[2 * kMaxDigits], got[2 * kMaxDigits];
+	fill(a, an);
+	fill(b, bn);
+
+	vi_mul_basecase_reference(want, a, an, b, bn);
+	vi_mul_basecase(got, a, an, b, bn);
+	expect("vi_mul_basecase", an + bn, got, 0, want, 0);
+}
+
+int main(void)
+{
+	printf("limb kernels: %s\n", vi_limb_kernels());
+
+	for(size_t n = 1; n <= kMaxDigits; n += n < 70 ? 1 : 23)
+		for(size_t t = 0; t < kTrials; t++)
+			check_kernels(n);
+
+	// the vector kernel takes factors of up to 64 digits, 65 falls back.
+	for(size_t an = 1; an <= 65; an++)
+		for(size_t bn = 1; bn <= an; bn++)
+		{
+			if(bn > 3 && bn + 3 < an
+			&& (bn + 2 < VI_IFMA_THRESHOLD || bn > VI_IFMA_THRESHOLD + 2))
+				continue;
+			for(size_t t = 0; t < kTrials; t++)
+				check_basecase(an, bn);
+		}
+
+	printf("%zu of %zu kernel and basecase results wrong\n", failures, count);
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
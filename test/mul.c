@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+#include "../src/limbs.h"
+
+/* Checks vi_mul_create_VarInt and vi_sqr_create_VarInt against the schoolbook
+product of vi_mul_basecase_reference. The operand lengths straddle the Karatsuba,
+Toom-Cook and NTT thresholds, which the mul_low test forces down to a few
+digits so that every tier recurses through the ones below it. */
+
+// the defaults of varint.c, the lengths below are placed around them.
+#ifndef VI_KARATSUBA_THRESHOLD
+#define VI_KARATSUBA_THRESHOLD 32
+#endif
+#ifndef VI_TOOM3_THRESHOLD
+#define VI_TOOM3_THRESHOLD 192
+#endif
+#ifndef VI_TOOM4_THRESHOLD
+#define VI_TOOM4_THRESHOLD 400
+#endif
+#ifndef VI_NTT_THRESHOLD
+#define VI_NTT_THRESHOLD (98304 / DIGIT_BITS)
+#endif
+
+enum { kTrials = 4 };
+
+static uint64_t state = 0x9e3779b97f4a7c15u;
+
+static uint64_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+static void fill(
+	digit_t * digits,
+	size_t n)
+{
+	int const mode = (int) (next_random() % 4);
+	for(size_t i = 0; i < n; i++)
+	{
+		digit_t const r = (digit_t) next_random();
+		switch(mode)
+		{
+		case 0: digits[i] = r; break;
+		case 1: digits[i] = (digit_t) ~(digit_t) 0; break;
+		case 2: digits[i] = next_random() % 8 ? (digit_t) ~(digit_t) 0 : r; break;
+		default: digits[i] = next_random() % 8 ? 0 : r; break;
+		}
+	}
+	// keep the length, so that the intended tier is taken.
+	if(!digits[n-1])
+		digits[n-1] = 1;
+}
+
+static void create_digits(
+	VarInt * this,
+	digit_t const * digits,
+	size_t n,
+	sign_t sign)
+{
+	vi_create_VarInt(this);
+	vi_copy_digit(&this->digits, digits, this->capacity = n);
+	this->size = n;
+	this->sign = sign;
+}
+
+static int equals(
+	VarInt const * this,
+	digit_t const * digits,
+	size_t n,
+	sign_t sign)
+{
+	while(n && !digits[n-1])
+		n--;
+	return this->size == n
+		&& this->sign == (n ? sign : kPos)
+		&& !memcmp(this->digits, digits, n * sizeof(digit_t));
+}
+
+static size_t failures = 0, count = 0;
+
+static void check_mul(
+	size_t an,
+	size_t bn)
+{
+	digit_t * const a = malloc(an * sizeof(digit_t));
+	digit_t * const b = malloc(bn * sizeof(digit_t));
+	digit_t * const want = malloc((an + bn) * sizeof(digit_t));
+	fill(a, an);
+	fill(b, bn);
+	if(an >= bn)
+		vi_mul_basecase_reference(want, a, an, b, bn);
+	else
+		vi_mul_basecase_reference(want, b, bn, a, an);
+
+	sign_t const sa = next_random() % 2 ? kNeg : kPos;
+	sign_t const sb = next_random() % 2 ? kNeg : kPos;
+	VarInt va, vb, p;
+	create_digits(&va, a, an, sa);
+	create_digits(&vb, b, bn, sb);
+
+	// both operand orders.
+	vi_mul_create_VarInt(&p, &va, &vb);
+	count++;
+	if(!equals(&p, want, an + bn, sa == sb ? kPos : kNeg))
+	{
+		failures++;
+		fprintf(stderr, "wrong product of %zu and %zu digits\n", an, bn);
+	}
+	vi_mul_assign_VarInt(&p, &vb, &va);
+	count++;
+	if(!equals(&p, want, an + bn, sa == sb ? kPos : kNeg))
+	{
+		failures++;
+		fprintf(stderr, "wrong product of %zu and %zu digits\n", bn, an);
+	}
+
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&va);
+	vi_destroy_VarInt(&vb);
+	free(a);
+	free(b);
+	free(want);
+}
+
+static void check_sqr(
+	size_t n)
+{
+	digit_t * const a = malloc(n * sizeof(digit_t));
+	digit_t * const want = malloc(2 * n * sizeof(digit_t));
+	fill(a, n);
+	vi_mul_basecase_reference(want, a, n, a, n);
+
+	VarInt va, p;
+	create_digits(&va, a, n, next_random() % 2 ? kNeg : kPos);
+
+	// the squaring kernel, reached directly and through equal operands.
+	vi_sqr_create_VarInt(&p, &va);
+	count++;
+	if(!equals(&p, want, 2 * n, kPos))
+	{
+		failures++;
+		fprintf(stderr, "wrong square of %zu digits\n", n);
+	}
+	vi_mul_assign_VarInt(&p, &va, &va);
+	count++;
+	if(!equals(&p, want, 2 * n, kPos))
+	{
+		failures++;
+		fprintf(stderr, "wrong product of %zu digits with itself\n", n);
+	}
+	vi_sqr_assign_VarInt(&va, &va);
+	count++;
+	if(!equals(&va, want, 2 * n, kPos))
+	{
+		failures++;
+		fprintf(stderr, "wrong square of %zu digits in place\n", n);
+	}
+
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&va);
+	free(a);
+	free(want);
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+
+	size_t const lengths[] = {
+		1, 2, 3, 7,
+		VI_KARATSUBA_THRESHOLD - 1, VI_KARATSUBA_THRESHOLD, VI_KARATSUBA_THRESHOLD + 1,
+		2 * VI_KARATSUBA_THRESHOLD - 1, 2 * VI_KARATSUBA_THRESHOLD + 1,
+		5 * VI_KARATSUBA_THRESHOLD + 3,
+		VI_TOOM3_THRESHOLD - 1, VI_TOOM3_THRESHOLD, VI_TOOM3_THRESHOLD + 1, VI_TOOM3_THRESHOLD + 2,
+		VI_TOOM4_THRESHOLD - 1, VI_TOOM4_THRESHOLD, VI_TOOM4_THRESHOLD + 1,
+		VI_TOOM4_THRESHOLD + 2, VI_TOOM4_THRESHOLD + 3,
+		5 * VI_TOOM4_THRESHOLD + 3,
+		VI_NTT_THRESHOLD - 1, VI_NTT_THRESHOLD, VI_NTT_THRESHOLD + 1
+	};
+	size_t const n = sizeof(lengths) / sizeof(*lengths);
+
+	for(size_t i = 0; i < n; i++)
+	{
+		for(size_t j = 0; j <= i; j++)
+			for(size_t t = 0; t < kTrials; t++)
+				check_mul(lengths[i], lengths[j]);
+		for(size_t t = 0; t < kTrials; t++)
+			check_sqr(lengths[i]);
+	}
+
+	printf("%zu of %zu products and squares wrong\n", failures, count);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
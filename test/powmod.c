@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+
+/* Checks the Montgomery context and vi_pow_mod_assign_VarInt against plain
+products reduced by division. Odd moduli take the Montgomery path, even ones
+reduce every product, and the modulus lengths straddle VI_REDC_THRESHOLD,
+which the powmod_low test forces down to one digit. The exponent lengths
+straddle the lengths at which the sliding window grows. Negative bases give
+negative results for odd exponents, like the remainder of the division. */
+
+// the default of varint.c.
+#ifndef VI_REDC_THRESHOLD
+#define VI_REDC_THRESHOLD 128
+#endif
+
+enum { kTrials = 3 };
+
+static uint64_t state = 0x9e3779b97f4a7c15u;
+
+static uint64_t next_random(void)
+{
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+// a random number of n digits, zero if n is 0.
+static void create_random(
+	VarInt * this,
+	size_t n)
+{
+	vi_create_VarInt(this);
+	if(!n)
+		return;
+
+	vi_calloc_digit(&this->digits, this->capacity = n);
+	int const mode = (int) (next_random() % 3);
+	for(size_t i = 0; i < n; i++)
+	{
+		digit_t const r = (digit_t) next_random();
+		this->digits[i] = mode == 1 ? (digit_t) ~(digit_t) 0 : mode == 2 && next_random() % 8 ? 0 : r;
+	}
+	if(!this->digits[n-1])
+		this->digits[n-1] = 1;
+	this->size = n;
+}
+
+// dest = x * y rem mod, with the remainder of the truncating division.
+static void mul_mod(
+	VarInt * dest,
+	VarInt const * x,
+	VarInt const * y,
+	VarInt const * mod)
+{
+	VarInt p;
+	vi_mul_create_VarInt(&p, x, y);
+	vi_div_mod_assign_VarInt(NULL, dest, &p, mod);
+	vi_destroy_VarInt(&p);
+}
+
+// dest = base^exp rem mod, by right to left binary exponentiation.
+static void pow_mod_reference(
+	VarInt * dest,
+	VarInt const * base,
+	VarInt const * exp,
+	VarInt const * mod)
+{
+	VarInt one, b, t;
+	vi_create_from_int_VarInt(&one, 1);
+	vi_div_mod_create_VarInt(NULL, dest, &one, mod);
+	vi_div_mod_create_VarInt(NULL, &b, base, mod);
+	vi_create_VarInt(&t);
+
+	for(size_t i = 0; i < exp->size; i++)
+		for(int bit = 0; bit < DIGIT_BITS; bit++)
+		{
+			if((exp->digits[i] >> bit) & 1)
+			{
+				mul_mod(&t, dest, &b, mod);
+				vi_copy_assign_VarInt(dest, &t);
+			}
+			mul_mod(&t, &b, &b, mod);
+			vi_copy_assign_VarInt(&b, &t);
+		}
+
+	vi_destroy_VarInt(&one);
+	vi_destroy_VarInt(&b);
+	vi_destroy_VarInt(&t);
+}
+
+// dest = base^exp, by right to left binary exponentiation.
+static void pow_reference(
+	VarInt * dest,
+	VarInt const * base,
+	unsigned exp)
+{
+	VarInt b, t;
+	vi_create_from_int_VarInt(dest, 1);
+	vi_copy_create_VarInt(&b, base);
+	vi_create_VarInt(&t);
+
+	for(; exp; exp >>= 1)
+	{
+		if(exp & 1)
+		{
+			vi_mul_assign_VarInt(&t, dest, &b);
+			vi_copy_assign_VarInt(dest, &t);
+		}
+		vi_mul_assign_VarInt(&t, &b, &b);
+		vi_copy_assign_VarInt(&b, &t);
+	}
+
+	vi_destroy_VarInt(&b);
+	vi_destroy_VarInt(&t);
+}
+
+static size_t failures = 0, count = 0;
+
+static void expect(
+	char const * what,
+	VarInt const * got,
+	VarInt const * want,
+	size_t mod_digits,
+	size_t exp_bits)
+{
+	count++;
+	if(vi_compare_VarInt(got, want))
+	{
+		failures++;
+		fprintf(stderr, "wrong %s: modulus of %zu digits, exponent of %zu bits\n", what, mod_digits, exp_bits);
+	}
+}
+
+// the context's products, squares and conversions for an odd modulus.
+static void check_montgomery(
+	size_t n)
+{
+	VarInt mod, x, y, xm, ym, z, want;
+	create_random(&mod, n);
+	mod.digits[0] |= 1;
+	create_random(&x, n);
+	create_random(&y, n);
+	vi_div_mod_assign_VarInt(NULL, &x, &x, &mod);
+	vi_div_mod_assign_VarInt(NULL, &y, &y, &mod);
+	vi_create_VarInt(&xm);
+	vi_create_VarInt(&ym);
+	vi_create_VarInt(&z);
+	vi_create_VarInt(&want);
+
+	Montgomery ctx;
+	vi_create_Montgomery(&ctx, &mod);
+	vi_to_montgomery_VarInt(&xm, &x, &ctx);
+	vi_to_montgomery_VarInt(&ym, &y, &ctx);
+
+	vi_from_montgomery_VarInt(&z, &xm, &ctx);
+	expect("Montgomery round trip", &z, &x, n, 0);
+
+	vi_montgomery_mul_assign_VarInt(&z, &xm, &ym, &ctx);
+	vi_from_montgomery_VarInt(&z, &z, &ctx);
+	mul_mod(&want, &x, &y, &mod);
+	expect("Montgomery product", &z, &want, n, 0);
+
+	vi_montgomery_sqr_assign_VarInt(&z, &xm, &ctx);
+	vi_from_montgomery_VarInt(&z, &z, &ctx);
+	mul_mod(&want, &x, &x, &mod);
+	expect("Montgomery square", &z, &want, n, 0);
+
+	vi_destroy_Montgomery(&ctx);
+	vi_destroy_VarInt(&mod);
+	vi_destroy_VarInt(&x);
+	vi_destroy_VarInt(&y);
+	vi_destroy_VarInt(&xm);
+	vi_destroy_VarInt(&ym);
+	vi_destroy_VarInt(&z);
+	vi_destroy_VarInt(&want);
+}
+
+static void check_pow_mod(
+	size_t n,
+	size_t bits,
+	int odd)
+{
+	VarInt mod, base, exp, got, want;
+	create_random(&mod, n);
+	if(odd)
+		mod.digits[0] |= 1;
+	else if(!(mod.digits[0] &= (digit_t) ~(digit_t) 1) && n == 1)
+		mod.digits[0] = 2;
+	create_random(&base, n + next_random() % 2);
+	if(next_random() % 2)
+		base.sign = kNeg;
+
+	// an exponent of exactly bits bits.
+	create_random(&exp, (bits + DIGIT_BITS - 1) / DIGIT_BITS);
+	if(bits)
+	{
+		digit_t const top = (digit_t) 1 << ((bits - 1) % DIGIT_BITS);
+		exp.digits[exp.size-1] = (exp.digits[exp.size-1] & (top - 1)) | top;
+	}
+
+	vi_create_VarInt(&got);
+	vi_create_VarInt(&want);
+	vi_pow_mod_assign_VarInt(&got, &base, &exp, &mod);
+	pow_mod_reference(&want, &base, &exp, &mod);
+	expect(odd ? "power, odd modulus" : "power, even modulus", &got, &want, n, bits);
+
+	vi_destroy_VarInt(&mod);
+	vi_destroy_VarInt(&base);
+	vi_destroy_VarInt(&exp);
+	vi_destroy_VarInt(&got);
+	vi_destroy_VarInt(&want);
+}
+
+static void check_pow(
+	size_t n,
+	unsigned e)
+{
+	VarInt base, exp, got, want;
+	create_random(&base, n);
+	if(next_random() % 2)
+		base.sign = kNeg;
+	vi_create_from_int_VarInt(&exp, (int) e);
+
+	size_t bits = 0;
+	for(unsigned v = e; v; v >>= 1)
+		bits++;
+
+	vi_pow_create_VarInt(&got, &base, &exp);
+	pow_reference(&want, &base, e);
+	expect("power without modulus", &got, &want, 0, bits);
+
+	vi_destroy_VarInt(&base);
+	vi_destroy_VarInt(&exp);
+	vi_destroy_VarInt(&got);
+	vi_destroy_VarInt(&want);
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+
+	static size_t const moduli[] = {
+		1, 2, 3, 5,
+		VI_REDC_THRESHOLD - (VI_REDC_THRESHOLD > 1), VI_REDC_THRESHOLD, VI_REDC_THRESHOLD + 1
+	};
+	static size_t const exponents[] = { 0, 1, 2, 3, 17, 64, 100 };
+	// the window grows past each of these lengths.
+	static size_t const windows[] = { 7, 25, 81, 241, 673, 1793, 4609 };
+
+	for(size_t i = 0; i < sizeof(moduli) / sizeof(*moduli); i++)
+		for(size_t t = 0; t < kTrials; t++)
+		{
+			check_montgomery(moduli[i]);
+			for(size_t j = 0; j < sizeof(exponents) / sizeof(*exponents); j++)
+			{
+				check_pow_mod(moduli[i], exponents[j], 1);
+				check_pow_mod(moduli[i], exponents[j], 0);
+			}
+		}
+
+	// the long exponents with short moduli only, to keep the reference fast.
+	for(size_t i = 0; i < sizeof(windows) / sizeof(*windows); i++)
+		for(size_t n = 1; n <= 3; n++)
+			for(size_t t = 0; t < kTrials; t++)
+			{
+				check_pow_mod(n, windows[i], 1);
+				check_pow_mod(n, windows[i] + 1, 1);
+				check_pow_mod(n, windows[i], 0);
+				check_pow_mod(n, windows[i] + 1, 0);
+			}
+
+	// without a modulus, the exponents stay within the first two windows.
+	static unsigned const powers[] = { 0, 1, 2, 3, 5, 64, 127, 128, 255, 256, 300, 511 };
+	for(size_t i = 0; i < sizeof(powers) / sizeof(*powers); i++)
+		for(size_t n = 1; n <= 2; n++)
+			for(size_t t = 0; t < kTrials; t++)
+				check_pow(n, powers[i]);
+
+	printf("%zu of %zu modular products and powers wrong\n", failures, count);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
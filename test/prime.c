@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+
+/* Checks the primality tests against a sieve for the numbers below kSieve,
+and against known primes and composites past it. The composites include
+Carmichael numbers and strong pseudoprimes to the first prime bases, with
+and without small factors, on both sides of the 81 bit limit of the
+deterministic Miller-Rabin base sets. The base 2 pseudoprimes are left to the
+Lucas part of the Baillie-PSW test. The strong Lucas pseudoprimes must pass
+that part, recomputed with vi_lucas_VarInt, and fail the whole test. */
+
+enum { kSieve = 20000 };
+
+static char const * const primes[] = {
+	"fff1", // 65521
+	"7fffffff", // 2^31 - 1
+	"3b9aca07", // 10^9 + 7
+	"ffffffffffffffc5", // 2^64 - 59
+	"1fffffffffffffff", // 2^61 - 1
+	"1ffffffffffffffffffffff", // 2^89 - 1
+	"2bacd5bc40aa9c67fffff", // 33 * 10^23 - 1
+	"2bacd5bc40aa9c6800017", // 33 * 10^23 + 23
+	"7ffffffffffffffffffffffffff", // 2^107 - 1
+	"7fffffffffffffffffffffffffffffff" // 2^127 - 1
+};
+
+static char const * const composites[] = {
+	"bfa17dc7", // 3215031751, strong pseudoprime to the bases 2, 3, 5 and 7
+	"351591274f9af9fb", // 3825123056546413051, to the bases up to 31
+	"437ae92817f9fc85b7e5", // 318665857834031151167461, to the bases up to 37
+	"2be6951adc5b22410a5fd", // 3317044064679887385961981, to the bases up to 41
+	"2007d37a6fd", // 1049077 * 2098153, strong pseudoprime to the base 2
+	"20000005b730004155eb5", // (2^40 + 5853) * (2^41 + 11705), strong pseudoprime to the base 2
+	"253a919ac20bb9", // 120427 * 240853 * 361279, a Carmichael number
+	"1440024411d5a2c60bdced8989", // a Carmichael number with factors near 2^33
+	"28800000559fbf003c5760f6262cb6f260791", // a Carmichael number with factors near 2^48
+	"3ffffffffffffffc000000000000001", // (2^61 - 1)^2
+	"ffffffffffffffffffffff7fffe0000000000000000000001", // (2^89 - 1) * (2^107 - 1)
+	"7ffffffffffffffff" // 2^67 - 1 = 193707721 * 761838257287
+};
+
+// the strong Lucas pseudoprimes below 10^5 for Selfridge's parameters.
+static int const lucas_pseudoprimes[] = {
+	5459, 5777, 10877, 16109, 18971, 22499, 24569, 25199, 40309, 58519, 75077, 97439
+};
+
+static size_t failures = 0, count = 0;
+
+static void expect(
+	char const * what,
+	char const * number,
+	int got,
+	int want)
+{
+	count++;
+	if(!got != !want)
+	{
+		failures++;
+		fprintf(stderr, "%s: %s is %s\n", what, number, want ? "prime" : "composite");
+	}
+}
+
+static void check(
+	VarInt const * n,
+	char const * number,
+	int prime)
+{
+	expect("vi_is_prime_quick_VarInt", number, vi_is_prime_quick_VarInt(n), prime);
+	expect("vi_is_prime_bpsw_VarInt", number, vi_is_prime_bpsw_VarInt(n), prime);
+	expect("vi_is_prime_miller_rabin_VarInt, default rounds", number, vi_is_prime_miller_rabin_VarInt(n, 0), prime);
+	// primes pass any number of rounds.
+	if(prime)
+		expect("vi_is_prime_miller_rabin_VarInt, 1 round", number, vi_is_prime_miller_rabin_VarInt(n, 1), prime);
+}
+
+/* the strong Lucas test with P = 1 and Q = (1 - D) / 4, for the first D in
+5, -7, 9, -11, ... with (D/n) = -1, and n + 1 = d * 2^s. n passes if U_d = 0
+or V_(d 2^r) = 0 for some r < s. */
+static int strong_lucas(
+	VarInt const * n)
+{
+	int dv = 5;
+	VarInt d, p, q, k, u, v;
+	for(;;)
+	{
+		vi_create_from_int_VarInt(&d, dv);
+		int const jacobi = vi_jacobi_VarInt(&d, n);
+		vi_destroy_VarInt(&d);
+		if(jacobi == -1)
+			break;
+		if(!jacobi)
+			return 0;
+		dv = dv > 0 ? -(dv + 2) : -dv + 2;
+	}
+
+	vi_create_from_int_VarInt(&p, 1);
+	vi_create_from_int_VarInt(&q, (1 - dv) / 4);
+	vi_create_VarInt(&k);
+	vi_create_VarInt(&u);
+	vi_create_VarInt(&v);
+	vi_add_assign_VarInt(&k, n, &p);
+	size_t s = 0;
+	while(!(k.digits[0] & 1))
+	{
+		vi_shr_assign_VarInt(&k, &k, 1);
+		s++;
+	}
+
+	vi_lucas_VarInt(&u, &v, &p, &q, &k, n);
+	int pass = !u.size || !v.size;
+	for(size_t r = 1; !pass && r < s; r++)
+	{
+		vi_shl_assign_VarInt(&k, &k, 1);
+		vi_lucas_VarInt(&u, &v, &p, &q, &k, n);
+		pass = !v.size;
+	}
+
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&q);
+	vi_destroy_VarInt(&k);
+	vi_destroy_VarInt(&u);
+	vi_destroy_VarInt(&v);
+	return pass;
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+
+	static char composite[kSieve];
+	composite[0] = composite[1] = 1;
+	for(int i = 2; i * i < kSieve; i++)
+		if(!composite[i])
+			for(int j = i * i; j < kSieve; j += i)
+				composite[j] = 1;
+
+	for(int i = 0; i < kSieve; i++)
+	{
+		VarInt n;
+		char number[16];
+		vi_create_from_int_VarInt(&n, i);
+		sprintf(number, "%d", i);
+		check(&n, number, !composite[i]);
+		vi_destroy_VarInt(&n);
+	}
+
+	for(size_t i = 0; i < sizeof(primes) / sizeof(*primes); i++)
+	{
+		VarInt n;
+		vi_create_from_hex_VarInt(&n, primes[i], strlen(primes[i]));
+		check(&n, primes[i], 1);
+		vi_destroy_VarInt(&n);
+	}
+	for(size_t i = 0; i < sizeof(composites) / sizeof(*composites); i++)
+	{
+		VarInt n;
+		vi_create_from_hex_VarInt(&n, composites[i], strlen(composites[i]));
+		check(&n, composites[i], 0);
+		vi_destroy_VarInt(&n);
+	}
+
+	for(size_t i = 0; i < sizeof(lucas_pseudoprimes) / sizeof(*lucas_pseudoprimes); i++)
+	{
+		VarInt n;
+		char number[16];
+		vi_create_from_int_VarInt(&n, lucas_pseudoprimes[i]);
+		sprintf(number, "%d", lucas_pseudoprimes[i]);
+		count++;
+		if(!strong_lucas(&n))
+		{
+			failures++;
+			fprintf(stderr, "%s passes the strong Lucas test\n", number);
+		}
+		expect("vi_is_prime_bpsw_VarInt", number, vi_is_prime_bpsw_VarInt(&n), 0);
+		vi_destroy_VarInt(&n);
+	}
+
+	printf("%zu of %zu primality results wrong\n", failures, count);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
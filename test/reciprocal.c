@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+
+/* Checks vi_reciprocal_VarInt against its definition: r = floor(2^bits / |d|)
+holds exactly if r * |d| <= 2^bits < (r + 1) * |d|. The divisor lengths
+straddle the division seed of the Newton iteration. */
+
+static VarInt one;
+
+static int check(
+	VarInt const * d,
+	size_t bits)
+{
+	VarInt r, p, e, ad;
+	vi_create_VarInt(&r);
+	vi_create_VarInt(&p);
+	vi_create_VarInt(&e);
+	vi_copy_create_VarInt(&ad, d);
+	ad.sign = kPos;
+
+	vi_reciprocal_VarInt(&r, d, bits);
+	int ok = !r.size || r.sign == d->sign;
+
+	r.sign = kPos;
+	vi_shl_assign_VarInt(&e, &one, (int) bits);
+	vi_mul_assign_VarInt(&p, &r, &ad);
+	ok = ok && vi_compare_VarInt(&p, &e) <= 0;
+	vi_add_assign_VarInt(&p, &p, &ad);
+	ok = ok && vi_compare_VarInt(&p, &e) > 0;
+
+	vi_destroy_VarInt(&r);
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&e);
+	vi_destroy_VarInt(&ad);
+	return ok;
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+	vi_create_from_int_VarInt(&one, 1);
+
+	static size_t const lengths[] = { 1, 7, 100, 2040, 2048, 2056, 4100, 20000 };
+	size_t failures = 0, count = 0;
+
+	for(size_t i = 0; i < sizeof(lengths) / sizeof(*lengths); i++)
+	{
+		size_t const m = 8 * lengths[i];
+		VarInt d[3];
+
+		// a random divisor, 2^m - 1, and a negative power of two.
+		vi_create_random_VarInt(&d[0], lengths[i]);
+		if(!d[0].size)
+			vi_inc_assign_VarInt(&d[0], &d[0]);
+		vi_create_VarInt(&d[1]);
+		vi_shl_assign_VarInt(&d[1], &one, (int) m);
+		vi_dec_assign_VarInt(&d[1], &d[1]);
+		vi_create_VarInt(&d[2]);
+		vi_shl_assign_VarInt(&d[2], &one, (int) m - 1);
+		d[2].sign = kNeg;
+
+		size_t const bits[] = { 0, m / 2, m + 5, 2 * m, 2 * m + 13, 3 * m };
+		for(size_t j = 0; j < 3; j++)
+		{
+			for(size_t k = 0; k < sizeof(bits) / sizeof(*bits); k++)
+			{
+				count++;
+				if(!check(&d[j], bits[k]))
+				{
+					failures++;
+					fprintf(stderr, "wrong reciprocal: divisor %zu of %zu bytes, %zu bits\n", j, lengths[i], bits[k]);
+				}
+			}
+			vi_destroy_VarInt(&d[j]);
+		}
+	}
+
+	printf("%zu of %zu reciprocals wrong\n", failures, count);
+	vi_destroy_VarInt(&one);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/varint.h"
+#include "../src/malloc.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Checks vi_next_prime_assign_VarInt against a sieve for small starts, and
+for large ones that its result is a prime and that no number between the
+start and the result is. The starts cross the sieve windows of the search,
+which the search_low test shrinks to a few candidates. The large starts are
+searched with one and with several threads, which test the survivors of a
+window out of order and must still return the smallest prime.
+vi_random_prime_VarInt must return odd primes of exactly the requested bits,
+with the flagged second highest bit and safe primes p = 2q + 1, q prime. */
+
+enum { kSieve = 110000 };
+
+static char composite[kSieve];
+static size_t failures = 0, count = 0;
+
+static void check_small(
+	int start)
+{
+	int want = start < 2 ? 2 : start;
+	while(composite[want])
+		want++;
+
+	VarInt n, p, w;
+	vi_create_from_int_VarInt(&n, start);
+	vi_create_VarInt(&p);
+	vi_create_from_int_VarInt(&w, want);
+	vi_next_prime_assign_VarInt(&p, &n);
+
+	count++;
+	if(vi_compare_VarInt(&p, &w))
+	{
+		failures++;
+		fprintf(stderr, "wrong next prime from %d\n", start);
+	}
+
+	vi_destroy_VarInt(&n);
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&w);
+}
+
+// start = 2^bits + offset.
+static void check_large(
+	int bits,
+	int offset)
+{
+	VarInt start, p, m, step;
+	vi_create_from_int_VarInt(&start, 1);
+	vi_shl_assign_VarInt(&start, &start, bits);
+	vi_create_from_int_VarInt(&m, offset);
+	vi_add_assign_VarInt(&start, &start, &m);
+	vi_create_VarInt(&p);
+	vi_create_from_int_VarInt(&step, 1);
+	vi_next_prime_assign_VarInt(&p, &start);
+
+	int ok = vi_compare_VarInt(&p, &start) >= 0 && vi_is_prime_bpsw_VarInt(&p);
+	for(vi_copy_assign_VarInt(&m, &start); ok && vi_compare_VarInt(&m, &p) < 0; vi_add_assign_VarInt(&m, &m, &step))
+		ok = !vi_is_prime_bpsw_VarInt(&m);
+
+	count++;
+	if(!ok)
+	{
+		failures++;
+		fprintf(stderr, "wrong next prime from 2^%d%+d\n", bits, offset);
+	}
+
+	vi_destroy_VarInt(&start);
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&m);
+	vi_destroy_VarInt(&step);
+}
+
+static int bit(
+	VarInt const * n,
+	size_t i)
+{
+	return i / DIGIT_BITS < n->size && (n->digits[i / DIGIT_BITS] >> (i % DIGIT_BITS)) & 1;
+}
+
+static void check_random(
+	size_t bits,
+	int flags)
+{
+	VarInt p, q;
+	vi_create_VarInt(&p);
+	vi_create_VarInt(&q);
+	vi_random_prime_VarInt(&p, bits, flags);
+	vi_shr_assign_VarInt(&q, &p, 1);
+
+	// exactly bits bits, as neither bit bits nor any above it is set.
+	int ok = p.sign == kPos
+		&& bit(&p, bits - 1) && !bit(&p, bits) && p.size == (bits + DIGIT_BITS - 1) / DIGIT_BITS
+		&& bit(&p, 0)
+		&& vi_is_prime_bpsw_VarInt(&p);
+	if(flags & kPrimeTopTwoBits)
+		ok = ok && bit(&p, bits - 2);
+	if(flags & kPrimeSafe)
+		ok = ok && bit(&p, 1) && vi_is_prime_bpsw_VarInt(&q);
+
+	count++;
+	if(!ok)
+	{
+		failures++;
+		fprintf(stderr, "wrong random prime of %zu bits, flags %d\n", bits, flags);
+	}
+
+	vi_destroy_VarInt(&p);
+	vi_destroy_VarInt(&q);
+}
+
+int main(void)
+{
+	vi_set_default_heap_size(4096);
+
+	composite[0] = composite[1] = 1;
+	for(int i = 2; i * i < kSieve; i++)
+		if(!composite[i])
+			for(int j = i * i; j < kSieve; j += i)
+				composite[j] = 1;
+
+	// every start up to 2000, then every 97th until past the sieve primes.
+	for(int start = 0; start < 2000; start++)
+		check_small(start);
+	for(int start = 2000; start < 100000; start += 97)
+		check_small(start);
+
+	static int const bits[] = { 31, 32, 63, 64, 89, 127, 256, 521 };
+	static int const offsets[] = { -1000, -1, 0, 1, 777 };
+	static int const threads[] = { 1, 4 };
+	for(size_t t = 0; t < sizeof(threads) / sizeof(*threads); t++)
+	{
+#ifdef _OPENMP
+		omp_set_num_threads(threads[t]);
+#else
+		if(t)
+			break;
+#endif
+		for(size_t i = 0; i < sizeof(bits) / sizeof(*bits); i++)
+			for(size_t j = 0; j < sizeof(offsets) / sizeof(*offsets); j++)
+				check_large(bits[i], offsets[j]);
+	}
+
+	// from the fewest bits each kind allows.
+	static size_t const sizes[] = { 2, 3, 4, 5, 6, 7, 8, 13, 31, 32, 33, 63, 64, 65, 100, 128, 256 };
+	for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+		for(int flags = 0; flags <= (kPrimeTopTwoBits | kPrimeSafe); flags++)
+		{
+			if(flags & kPrimeSafe && sizes[i] < (flags & kPrimeTopTwoBits ? 6u : 3u))
+				continue;
+			for(size_t t = 0; t < 4; t++)
+				check_random(sizes[i], flags);
+		}
+
+	printf("%zu of %zu prime searches wrong\n", failures, count);
+	vi_destroy_heap();
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}